@@ -0,0 +1,314 @@
+#!/bin/bash
+#
+# Benchmark of sch_dwrr / sch_dwrr2 over a veth pair between two network
+# namespaces. The qdisc shapes the egress veth of the sender namespace.
+# Each class (DSCP) runs TCP flows of iperf3 and a ping for the RTT, and
+# CE marks are counted by iptables in the receiver namespace, so that the
+# same measurement works for both modules.
+#
+# Every combination of the swept sysctl parameters is run, and one CSV
+# line per class and run is written:
+#
+#	module,run,ecn_scheme,port_thresh_bytes,round_alpha,idle_interval_ns,
+#	queue,dscp,throughput_mbps,pkts,ce_pkts,mark_rate,
+#	rtt_samples,rtt_p50_us,rtt_p99_us,rtt_max_us
+#
+# Requires root, iproute2, iperf3, ping, iptables (with the dscp and ecn
+# matches) and ethtool.
+
+set -u
+
+usage()
+{
+	cat >&2 <<EOF
+Usage: $0 [options]
+  -m MODULE     sch_dwrr or sch_dwrr2 (default: sch_dwrr2)
+  -k KO         kernel module to load if it is not loaded
+                (default: MODULE/sch_dwrr.ko of this repository)
+  -r RATE       shaping rate, as tc takes it (default: 1000mbit)
+  -q "DSCPS"    DSCP of each class, queue i gets the i-th (default: "0 8")
+  -P FLOWS      TCP flows per class (default: 2)
+  -d SECONDS    duration of a run (default: 10)
+  -n RUNS       runs of each combination (default: 1)
+  -c CC         TCP congestion control (default: dctcp if available)
+  -g            keep GSO/TSO/GRO on the veth pair (default: off)
+  -e "VALUES"   ecn_scheme values (default: "1 2 3")
+  -t "VALUES"   port threshold values in bytes, port_thresh_bytes
+                (port_thresh of sch_dwrr2) (default: current sysctl)
+  -a "VALUES"   round_alpha values (default: current sysctl)
+  -i "VALUES"   idle_interval_ns values (default: current sysctl)
+  -o FILE       write the results to FILE (default: stdout)
+EOF
+	exit 1
+}
+
+die()
+{
+	echo "$0: $*" >&2
+	exit 1
+}
+
+tx_ns=dwrr_bench_tx
+rx_ns=dwrr_bench_rx
+tx_if=dwrr_bench0
+rx_if=dwrr_bench1
+tx_ip=10.254.0.1
+rx_ip=10.254.0.2
+base_port=5201
+chain=DWRR_BENCH
+
+repo=$(cd "$(dirname "$0")/.." && pwd)
+module=sch_dwrr2
+ko=
+rate=1000mbit
+dscps="0 8"
+flows=2
+duration=10
+runs=1
+cc=
+offload=off
+ecn_values="1 2 3"
+thresh_values=
+alpha_values=
+idle_values=
+out=/dev/stdout
+
+while getopts "m:k:r:q:P:d:n:c:ge:t:a:i:o:h" opt
+do
+	case $opt in
+		m) module=$OPTARG ;;
+		k) ko=$OPTARG ;;
+		r) rate=$OPTARG ;;
+		q) dscps=$OPTARG ;;
+		P) flows=$OPTARG ;;
+		d) duration=$OPTARG ;;
+		n) runs=$OPTARG ;;
+		c) cc=$OPTARG ;;
+		g) offload=on ;;
+		e) ecn_values=$OPTARG ;;
+		t) thresh_values=$OPTARG ;;
+		a) alpha_values=$OPTARG ;;
+		i) idle_values=$OPTARG ;;
+		o) out=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+
+[ "$module" = sch_dwrr ] || [ "$module" = sch_dwrr2 ] ||
+	die "unknown module $module"
+# The port threshold in bytes has another sysctl name in sch_dwrr2
+thresh_param=port_thresh_bytes
+[ "$module" = sch_dwrr2 ] && thresh_param=port_thresh
+[ "$(id -u)" -eq 0 ] || die "must be run as root"
+for cmd in ip tc iperf3 ping iptables ethtool sysctl
+do
+	command -v $cmd > /dev/null || die "$cmd not found"
+done
+
+read -r -a dscp_list <<< "$dscps"
+[ ${#dscp_list[@]} -ge 1 ] && [ ${#dscp_list[@]} -le 8 ] ||
+	die "1 to 8 classes are supported"
+
+# Load the module. sch_dwrr replaces tbf.
+if [ ! -d /sys/module/sch_dwrr ]
+then
+	[ -n "$ko" ] || ko=$repo/$module/sch_dwrr.ko
+	[ -f "$ko" ] || die "$ko not found, build the module first"
+	[ "$module" = sch_dwrr ] && rmmod sch_tbf 2> /dev/null
+	insmod "$ko" || die "cannot load $ko"
+fi
+
+if [ -z "$cc" ]
+then
+	if modprobe tcp_dctcp 2> /dev/null ||
+	   grep -qw dctcp /proc/sys/net/ipv4/tcp_available_congestion_control
+	then
+		cc=dctcp
+	else
+		cc=cubic
+	fi
+fi
+
+# Parameters changed by the sweep, restored on exit
+params="ecn_scheme $thresh_param round_alpha idle_interval_ns"
+for i in "${!dscp_list[@]}"
+do
+	params="$params queue_dscp_$i"
+done
+declare -A saved
+for p in $params
+do
+	saved[$p]=$(sysctl -n dwrr.$p) || die "dwrr.$p not found"
+done
+
+[ -n "$thresh_values" ] || thresh_values=${saved[$thresh_param]}
+[ -n "$alpha_values" ] || alpha_values=${saved[round_alpha]}
+[ -n "$idle_values" ] || idle_values=${saved[idle_interval_ns]}
+
+tmp=$(mktemp -d)
+
+cleanup()
+{
+	jobs -p | xargs -r kill 2> /dev/null
+	wait 2> /dev/null
+	ip netns del $tx_ns 2> /dev/null
+	ip netns del $rx_ns 2> /dev/null
+	for p in "${!saved[@]}"
+	do
+		sysctl -qw dwrr.$p="${saved[$p]}"
+	done
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+tx()
+{
+	ip netns exec $tx_ns "$@"
+}
+
+rx()
+{
+	ip netns exec $rx_ns "$@"
+}
+
+setup()
+{
+	local ns i
+
+	ip netns add $tx_ns || die "cannot create namespace $tx_ns"
+	ip netns add $rx_ns || die "cannot create namespace $rx_ns"
+	ip link add $tx_if netns $tx_ns type veth peer name $rx_if \
+		netns $rx_ns || die "cannot create the veth pair"
+
+	tx ip addr add $tx_ip/24 dev $tx_if
+	rx ip addr add $rx_ip/24 dev $rx_if
+	for ns in $tx_ns $rx_ns
+	do
+		ip netns exec $ns ip link set lo up
+		ip netns exec $ns sysctl -qw net.ipv4.tcp_ecn=1
+	done
+	tx ip link set $tx_if up
+	rx ip link set $rx_if up
+	tx ethtool -K $tx_if tso $offload gso $offload gro $offload \
+		> /dev/null 2>&1
+	rx ethtool -K $rx_if tso $offload gso $offload gro $offload \
+		> /dev/null 2>&1
+
+	# Rules 2i + 1 and 2i + 2 count the packets and CE packets of class i
+	rx iptables -t mangle -N $chain
+	rx iptables -t mangle -A PREROUTING -i $rx_if -p tcp -j $chain
+	for i in "${!dscp_list[@]}"
+	do
+		rx iptables -t mangle -A $chain -m dscp --dscp ${dscp_list[$i]}
+		rx iptables -t mangle -A $chain -m dscp --dscp ${dscp_list[$i]} \
+			-m ecn --ecn-ip-ect 3
+	done
+
+	for i in "${!dscp_list[@]}"
+	do
+		rx iperf3 -s -D -p $((base_port + i)) -B $rx_ip > /dev/null ||
+			die "cannot start iperf3 server"
+	done
+	sleep 1
+}
+
+# Install the qdisc again, so that each run starts from an empty port
+install_qdisc()
+{
+	tx tc qdisc del dev $tx_if root 2> /dev/null
+	if [ "$module" = sch_dwrr ]
+	then
+		tx tc qdisc add dev $tx_if root tbf rate $rate limit 1000k \
+			burst 1000k mtu 66000
+	else
+		tx tc qdisc add dev $tx_if root dwrr rate $rate
+	fi
+}
+
+# Print the packet counter of rule n of the chain
+rule_pkts()
+{
+	rx iptables -t mangle -L $chain -n -v -x |
+		awk -v n="$1" 'NR == n + 2 { print $1 }'
+}
+
+# Print "samples p50 p99 max" of the RTTs (us) in a ping output
+rtt_stats()
+{
+	sed -n 's/.*time=\([0-9.]*\) ms.*/\1/p' "$1" | sort -n |
+		awk '{ v[NR] = $1 * 1000 }
+		     END {
+			if (NR == 0) { print "0 0 0 0"; exit }
+			p50 = v[int((NR - 1) * 0.5) + 1]
+			p99 = v[int((NR - 1) * 0.99) + 1]
+			printf "%d %.0f %.0f %.0f\n", NR, p50, p99, v[NR]
+		     }'
+}
+
+# Run all the classes at once and print a CSV line per class
+run()
+{
+	local run=$1 prefix=$2 i tos pkts ce mbps rate_ce rtt
+
+	install_qdisc || die "cannot install the qdisc"
+	rx iptables -t mangle -Z $chain
+
+	for i in "${!dscp_list[@]}"
+	do
+		tos=$((dscp_list[i] << 2))
+		tx ping -n -Q $tos -i 0.001 -w $duration $rx_ip \
+			> "$tmp/ping$i" 2>&1 &
+		tx iperf3 -c $rx_ip -p $((base_port + i)) -B $tx_ip \
+			-t $duration -P $flows -S $tos -C $cc -f m \
+			> "$tmp/iperf$i" 2>&1 &
+	done
+	wait
+
+	for i in "${!dscp_list[@]}"
+	do
+		mbps=$(awk '/receiver/ {
+				for (j = 1; j <= NF; j++)
+					if ($j == "Mbits/sec")
+						v = $(j - 1)
+			    }
+			    END { print v + 0 }' "$tmp/iperf$i")
+		pkts=$(rule_pkts $((2 * i + 1)))
+		ce=$(rule_pkts $((2 * i + 2)))
+		rate_ce=$(awk -v p="$pkts" -v c="$ce" \
+			  'BEGIN { printf "%.6f", p > 0 ? c / p : 0 }')
+		rtt=$(rtt_stats "$tmp/ping$i")
+		echo "$module,$run,$prefix,$i,${dscp_list[$i]},$mbps,$pkts,$ce,$rate_ce,${rtt// /,}"
+	done
+}
+
+setup
+
+for i in "${!dscp_list[@]}"
+do
+	sysctl -qw dwrr.queue_dscp_$i=${dscp_list[$i]}
+done
+
+echo "module,run,ecn_scheme,port_thresh_bytes,round_alpha,idle_interval_ns,queue,dscp,throughput_mbps,pkts,ce_pkts,mark_rate,rtt_samples,rtt_p50_us,rtt_p99_us,rtt_max_us" > "$out"
+
+for ecn in $ecn_values
+do
+	for thresh in $thresh_values
+	do
+		for alpha in $alpha_values
+		do
+			for idle in $idle_values
+			do
+				sysctl -qw dwrr.ecn_scheme=$ecn \
+					dwrr.$thresh_param=$thresh \
+					dwrr.round_alpha=$alpha \
+					dwrr.idle_interval_ns=$idle ||
+					die "cannot set the parameters"
+				for ((r = 1; r <= runs; r++))
+				do
+					run $r "$ecn,$thresh,$alpha,$idle" >> "$out"
+				done
+			done
+		done
+	done
+done
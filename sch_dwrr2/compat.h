@@ -0,0 +1,247 @@
+#ifndef __COMPAT_H__
+#define __COMPAT_H__
+
+/*
+ * The DWRR/MQ-ECN core (dwrr.c) is built both as part of the kernel module
+ * and as a userspace library for the trace-driven simulator (see sim/).
+ * In the kernel we simply pull in the real headers. In userspace we provide
+ * the small subset of kernel types and helpers that the core relies on.
+ */
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/u64_stats_sync.h>
+#include <net/sch_generic.h>
+#include <net/pkt_sched.h>
+
+#else
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int32_t		s32;
+typedef int64_t		s64;
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define min_t(type, x, y)	({ type __x = (x); type __y = (y); \
+				   __x < __y ? __x : __y; })
+#define max_t(type, x, y)	({ type __x = (x); type __y = (y); \
+				   __x > __y ? __x : __y; })
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+#define NSEC_PER_SEC	1000000000LL
+
+#define KERN_INFO	""
+#define printk(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+/* Position of the most significant bit set, 1-based (0 if x is 0) */
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define ____cacheline_aligned_in_smp	__attribute__((__aligned__(64)))
+
+/* The simulator is single threaded, so atomics are plain integers */
+typedef struct
+{
+	int counter;
+} atomic_t;
+
+typedef struct
+{
+	s64 counter;
+} atomic64_t;
+
+#define atomic_read(v)			((v)->counter)
+#define atomic_set(v, i)		((v)->counter = (i))
+#define atomic_add(i, v)		((v)->counter += (i))
+#define atomic_sub(i, v)		((v)->counter -= (i))
+#define atomic_sub_return(i, v)		((v)->counter -= (i))
+#define atomic64_read(v)		((v)->counter)
+#define atomic64_set(v, i)		((v)->counter = (i))
+
+/*
+ * Pseudo random numbers (xorshift32), following the per-CPU prandom_u32().
+ * The simulator has a single CPU, and a fixed seed keeps runs reproducible.
+ */
+static u32 prandom_state = 2463534242U;
+
+static inline u32 prandom_u32(void)
+{
+	u32 x = prandom_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	prandom_state = x;
+	return x;
+}
+
+/* Bitmap, following <linux/bitmap.h> (non-atomic operations only) */
+#define BITS_PER_LONG		(8 * sizeof(unsigned long))
+#define BITS_TO_LONGS(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline void __set_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+/* Index of the first set bit at or after offset, or size if none */
+static inline unsigned long find_next_bit(const unsigned long *addr,
+					  unsigned long size,
+					  unsigned long offset)
+{
+	unsigned long word;
+
+	if (offset >= size)
+		return size;
+
+	word = addr[offset / BITS_PER_LONG] & (~0UL << (offset % BITS_PER_LONG));
+	offset -= offset % BITS_PER_LONG;
+
+	while (!word)
+	{
+		offset += BITS_PER_LONG;
+		if (offset >= size)
+			return size;
+		word = addr[offset / BITS_PER_LONG];
+	}
+
+	offset += __builtin_ctzl(word);
+	return offset < size ? offset : size;
+}
+
+#define find_first_bit(addr, size)	find_next_bit((addr), (size), 0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Doubly linked list, following <linux/list.h> */
+struct list_head
+{
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new,
+			      struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next)
+{
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+
+/* The simulator has a single CPU, so per-CPU data has a single copy */
+#define __percpu
+#define this_cpu_ptr(ptr)		(ptr)
+#define per_cpu_ptr(ptr, cpu)		((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu)	for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+struct u64_stats_sync
+{
+};
+
+#define u64_stats_update_begin(syncp)	do { } while (0)
+#define u64_stats_update_end(syncp)	do { } while (0)
+
+static inline unsigned int
+u64_stats_fetch_begin(const struct u64_stats_sync *syncp)
+{
+	return 0;
+}
+
+static inline bool u64_stats_fetch_retry(const struct u64_stats_sync *syncp,
+					 unsigned int start)
+{
+	return false;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,1322 @@
+#include "dwrr.h"
+#include "trace.h"
+
+/* Exponential Weighted Moving Average (EWMA) for s64 */
+static inline s64 s64_ewma(s64 smooth, s64 sample, int weight, int shift)
+{
+	s64 val = smooth * weight;
+	val += sample * ((1 << shift) - weight);
+	return val >> shift;
+}
+
+/*
+ * Borrow from psched_ratecfg_precompute: choose the largest shift which
+ * keeps mult in 32 bits, so that l2t_ns stays precise from 1M to 100G+.
+ */
+void precompute_ratedata(struct dwrr_rate_cfg *r)
+{
+	u64 factor = 8ULL * NSEC_PER_SEC;
+
+	r->shift = 0;
+	r->mult = 1;
+
+	if (r->rate_bps > 0)
+	{
+		while (1)
+		{
+			r->mult = div64_u64(factor, r->rate_bps);
+			if (r->mult & (1U << 31) || factor & (1ULL << 63))
+				break;
+			factor <<= 1;
+			r->shift++;
+		}
+	}
+}
+
+/* Token bucket size in ns */
+static inline s64 dwrr_bucket_ns(struct dwrr_sched_data *q)
+{
+	if (q->cfg.bucket_bytes > 0)
+		return (s64)l2t_ns(&q->rate, q->cfg.bucket_bytes);
+
+	return max_t(s64, dwrr_auto_bucket_ns,
+		     (s64)l2t_ns(&q->rate, dwrr_max_pkt_bytes));
+}
+
+/* Fixed point of the reciprocal of round time */
+#define dwrr_round_inv_shift 40
+
+/*
+ * Reciprocal of round time. It is computed once per sample rather than for
+ * every packet that MQ-ECN checks. The SCFQ weight sum and the share of
+ * the DWRR band keep their reciprocals as well.
+ */
+static inline u64 dwrr_round_inv(s64 round_time)
+{
+	if (round_time > 0)
+		return div64_u64(1ULL << dwrr_round_inv_shift, round_time);
+
+	return 0;
+}
+
+/* Set round time of the port */
+static inline void dwrr_round_set(struct dwrr_port *port, s64 round_time)
+{
+	atomic64_set(&port->round_time, round_time);
+	atomic64_set(&port->round_inv, dwrr_round_inv(round_time));
+}
+
+/* Set round time of the queues of a tenant */
+static inline void dwrr_tenant_round_set(struct dwrr_tenant *t,
+					 s64 round_time)
+{
+	t->round_time = round_time;
+	t->round_inv = dwrr_round_inv(round_time);
+}
+
+/*
+ * Update round time estimation of the port with a new sample of queue id,
+ * or of tenant id with tenants
+ */
+static inline void dwrr_round_update(struct dwrr_sched_data *q,
+				     int id,
+				     s64 sample)
+{
+	struct dwrr_port *port = q->port;
+	/*
+	 * Schedulers of the same port may race here. We may lose a sample,
+	 * which is fine for an estimation, but we never tear the value.
+	 */
+	s64 smooth = s64_ewma(atomic64_read(&port->round_time),
+			      sample,
+			      q->cfg.round_alpha, dwrr_round_alpha_shift);
+
+	dwrr_round_set(port, smooth);
+	trace_dwrr_round(q, -1, id, sample, smooth);
+}
+
+/*
+ * Update round time estimation of the queues of tenant t with a new
+ * sample of queue id. Only this scheduler serves the tenant.
+ */
+static inline void dwrr_tenant_round_update(struct dwrr_sched_data *q,
+					    struct dwrr_tenant *t,
+					    int id,
+					    s64 sample)
+{
+	dwrr_tenant_round_set(t, s64_ewma(t->round_time, sample,
+					  q->cfg.round_alpha,
+					  dwrr_round_alpha_shift));
+	trace_dwrr_round(q, t->id, id, sample, t->round_time);
+}
+
+/*
+ * Decay round time after n idle intervals in closed form, as n updates
+ * with a zero sample would do. Round times of tenants decay as well.
+ */
+static inline void dwrr_round_decay(struct dwrr_sched_data *q, int n)
+{
+	struct dwrr_port *port = q->port;
+	struct dwrr_tenant *t;
+	s64 smooth = (atomic64_read(&port->round_time) * q->idle_decay[n]) >>
+		     dwrr_share_shift;
+	int i;
+
+	dwrr_round_set(port, smooth);
+	trace_dwrr_round(q, -1, -1, 0, smooth);
+
+	for (i = 0; i < q->num_tenants; i++)
+	{
+		t = &(q->tenants[i]);
+		dwrr_tenant_round_set(t, (t->round_time * q->idle_decay[n]) >>
+					 dwrr_share_shift);
+	}
+}
+
+/* Update the share of the DWRR band after the strict priority rate */
+static void dwrr_band_share_update(struct dwrr_sched_data *q)
+{
+	u64 share = 1ULL << dwrr_share_shift;
+
+	if (q->rate.rate_bps > 0)
+		share = div64_u64(dwrr_band_rate(q) << dwrr_share_shift,
+				  q->rate.rate_bps);
+
+	if (share != q->band_share)
+	{
+		q->band_share = share;
+		q->band_inv = dwrr_round_inv(share);
+		q->ecn_gen++;
+	}
+}
+
+/*
+ * Add the quantum of a queue entering (or leaving) the SCFQ heap. The
+ * reciprocal of the sum is only computed again when MQ-ECN needs it.
+ */
+static inline void dwrr_fq_weight_add(struct dwrr_sched_data *q, s64 quantum)
+{
+	q->fq_weight_sum += quantum;
+	q->fq_weight_inv = 0;
+}
+
+/* Empty the active flows of cl */
+static void dwrr_flows_reset(struct dwrr_class *cl)
+{
+	int i;
+
+	cl->flow_head = -1;
+	cl->flow_tail = -1;
+	for (i = 0; i < dwrr_class_flows(cl); i++)
+	{
+		(cl->flows[i]).deficit = 0;
+		(cl->flows[i]).len_bytes = 0;
+		(cl->flows[i]).next = -1;
+	}
+}
+
+void dwrr_flows_attach(struct dwrr_class *cl, struct dwrr_flow *flows)
+{
+	int i;
+
+	for (i = 1; i < dwrr_fq_flows; i++)
+	{
+		flows[i].deficit = 0;
+		flows[i].len_bytes = 0;
+		flows[i].next = -1;
+	}
+	flows[0].deficit = (cl->flow).deficit;
+	flows[0].len_bytes = (cl->flow).len_bytes;
+	flows[0].next = -1;
+
+	cl->flows = flows;
+}
+
+void dwrr_port_init(struct dwrr_port *port, s64 now)
+{
+	atomic_set(&port->sum_len_bytes, 0);
+	atomic_set(&port->shared_len_bytes, 0);
+	dwrr_round_set(port, 0);
+	atomic64_set(&port->last_idle_time, now);
+}
+
+/* Reset the tenant to its queues with no active queue */
+static void dwrr_tenant_reset(struct dwrr_sched_data *q,
+			      struct dwrr_tenant *t,
+			      s64 now)
+{
+	__clear_bit(t->id, q->tenant_active);
+	t->cursor = t->first;
+	t->active = 0;
+	t->deficit = 0;
+	t->start_time = now;
+	t->last_pkt_time = now;
+}
+
+void dwrr_sched_init(struct dwrr_sched_data *q,
+		     struct dwrr_class *queues,
+		     unsigned long *active,
+		     struct dwrr_class **heap,
+		     struct dwrr_tenant *tenants,
+		     struct dwrr_class_stats __percpu *stats,
+		     struct dwrr_port *port,
+		     s64 now)
+{
+	int n = q->cfg.num_queues;
+	struct dwrr_tenant *t;
+	int i, cpu;
+
+	q->queues = queues;
+	q->stats = stats;
+	q->active = active;
+	q->cursor = 0;
+	q->sp_active = active + BITS_TO_LONGS(q->cfg.num_queues);
+	q->sp_levels = 0;
+	memset(q->sp_count, 0, sizeof(q->sp_count));
+	q->heap = heap;
+	q->heap_len = 0;
+	q->vtime = 0;
+	q->fq_weight_sum = 0;
+	q->fq_weight_inv = 0;
+	q->throttled = NULL;
+	q->port = port;
+	q->tokens = 0;
+	q->time_ns = now;
+	q->sp_rate_bps = 0;
+	q->sp_bytes = 0;
+	q->sp_time = now;
+
+	/* Tenants are groups of tenant_queues consecutive queues */
+	q->tenants = tenants;
+	q->num_tenants = dwrr_num_tenants(&q->cfg);
+	q->tenant_active = active + 2 * BITS_TO_LONGS(n);
+	q->tenant_cursor = 0;
+	for (i = 0; i < q->num_tenants; i++)
+	{
+		t = &(q->tenants[i]);
+		dwrr_tenant_cfg_init(&t->cfg, i);
+		t->id = i;
+		t->first = i * q->cfg.tenant_queues;
+		t->last = min_t(int, t->first + q->cfg.tenant_queues, n);
+		t->quantum = 0;
+		dwrr_tenant_round_set(t, 0);
+		dwrr_tenant_reset(q, t, now);
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		__clear_bit(i, q->active);
+		__clear_bit(i, q->sp_active);
+		dwrr_queue_cfg_init(&((q->queues[i]).cfg), i);
+		(q->queues[i]).id = i;
+		(q->queues[i]).deficit = 0;
+		(q->queues[i]).len_bytes = 0;
+		(q->queues[i]).shared_bytes = 0;
+		(q->queues[i]).start_time = now;
+		(q->queues[i]).last_pkt_time = now;
+		(q->queues[i]).quantum = 0;
+		(q->queues[i]).prio = 0;
+		(q->queues[i]).finish = 0;
+		(q->queues[i]).inv_weight = 0;
+		(q->queues[i]).heap_index = -1;
+		(q->queues[i]).mq_gen = 0;
+		(q->queues[i]).tenant = NULL;
+		if (q->num_tenants > 0)
+			(q->queues[i]).tenant =
+				&(q->tenants[i / q->cfg.tenant_queues]);
+		(q->queues[i]).stats = stats + i;
+		memset((q->queues[i]).sojourn, 0, sizeof((q->queues[i]).sojourn));
+		(q->queues[i]).flows = &((q->queues[i]).flow);
+		dwrr_flows_reset(&(q->queues[i]));
+	}
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(stats, cpu), 0,
+		       n * sizeof(struct dwrr_class_stats));
+
+	q->band_share = 0;
+	q->band_inv = 0;
+	q->ecn_gen = 1;
+	dwrr_sched_config(q);
+}
+
+/*
+ * Quantum of the next rounds of tenant t: its own, or the sum of the quanta
+ * of its DWRR queues, so that a round of the tenant serves each of them
+ * once
+ */
+static void dwrr_tenant_config(struct dwrr_sched_data *q,
+			       struct dwrr_tenant *t)
+{
+	u32 quantum = 0;
+	int i;
+
+	if (t->cfg.quantum > 0)
+		quantum = t->cfg.quantum;
+	else
+	{
+		for (i = t->first; i < t->last; i++)
+		{
+			if ((q->queues[i]).cfg.prio == 0)
+				quantum += (q->queues[i]).cfg.quantum;
+		}
+	}
+
+	t->next_quantum = max_t(u32, quantum, dwrr_max_pkt_bytes);
+}
+
+void dwrr_sched_config(struct dwrr_sched_data *q)
+{
+	u64 decay = 1ULL << dwrr_share_shift;
+	int i;
+
+	/* Cached thresholds depend on the rate and on the configuration */
+	q->ecn_gen++;
+	dwrr_band_share_update(q);
+
+	q->idle_inv = 0;
+	if (q->cfg.idle_interval_ns > 0)
+		q->idle_inv = div64_u64(1ULL << 40, q->cfg.idle_interval_ns);
+
+	/* Percentages of the marking profile in fixed point */
+	q->ramp_min = (q->cfg.ecn_ramp_min << dwrr_ecn_ramp_shift) / 100;
+	q->ramp_max = (q->cfg.ecn_ramp_max << dwrr_ecn_ramp_shift) / 100;
+	q->ramp_prob = 1 << dwrr_ecn_ramp_shift;
+	if (q->cfg.ecn_profile == dwrr_ecn_ramp_step)
+		q->ramp_prob = (q->cfg.ecn_ramp_prob << dwrr_ecn_ramp_shift) /
+			       100;
+
+	for (i = 0; i <= dwrr_max_iteration; i++)
+	{
+		q->idle_decay[i] = decay;
+		decay = (decay * q->cfg.round_alpha) >> dwrr_round_alpha_shift;
+	}
+
+	/* Virtual time of a byte of each queue under SCFQ */
+	for (i = 0; i < q->cfg.num_queues; i++)
+		(q->queues[i]).inv_weight =
+			div_u64(1ULL << 32, (q->queues[i]).cfg.quantum);
+
+	for (i = 0; i < q->num_tenants; i++)
+		dwrr_tenant_config(q, &(q->tenants[i]));
+}
+
+void dwrr_class_stats_read(struct dwrr_class *cl, struct dwrr_class_stats *sum)
+{
+	struct dwrr_class_stats *st, val;
+	unsigned int start;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu)
+	{
+		st = per_cpu_ptr(cl->stats, cpu);
+		do
+		{
+			start = u64_stats_fetch_begin(&st->syncp);
+			val = *st;
+		} while (u64_stats_fetch_retry(&st->syncp, start));
+
+		sum->enq_bytes += val.enq_bytes;
+		sum->enq_pkts += val.enq_pkts;
+		sum->deq_bytes += val.deq_bytes;
+		sum->deq_pkts += val.deq_pkts;
+		sum->drops += val.drops;
+		sum->marks += val.marks;
+		sum->overlimits += val.overlimits;
+		sum->watchdogs += val.watchdogs;
+	}
+}
+
+void dwrr_sched_reset(struct dwrr_sched_data *q, s64 now)
+{
+	struct dwrr_class *cl;
+	int i;
+
+	for (i = 0; i < q->cfg.num_queues; i++)
+	{
+		cl = &(q->queues[i]);
+		/* Give our share of the port buffer back */
+		if (cl->len_bytes > 0)
+			atomic_sub(cl->len_bytes, &q->port->sum_len_bytes);
+		if (cl->shared_bytes > 0)
+			atomic_sub(cl->shared_bytes,
+				   &q->port->shared_len_bytes);
+
+		__clear_bit(i, q->active);
+		__clear_bit(i, q->sp_active);
+		cl->heap_index = -1;
+		cl->deficit = 0;
+		cl->len_bytes = 0;
+		cl->shared_bytes = 0;
+		dwrr_flows_reset(cl);
+		cl->start_time = now;
+		cl->last_pkt_time = now;
+	}
+
+	for (i = 0; i < q->num_tenants; i++)
+		dwrr_tenant_reset(q, &(q->tenants[i]), now);
+
+	q->sp_levels = 0;
+	memset(q->sp_count, 0, sizeof(q->sp_count));
+	q->heap_len = 0;
+	q->fq_weight_sum = 0;
+	q->fq_weight_inv = 0;
+}
+
+/* Whether virtual time a is before b. Virtual time may wrap around. */
+static inline bool dwrr_vt_before(u64 a, u64 b)
+{
+	return (s64)(a - b) < 0;
+}
+
+static inline void dwrr_heap_set(struct dwrr_sched_data *q, int i,
+				 struct dwrr_class *cl)
+{
+	q->heap[i] = cl;
+	cl->heap_index = i;
+}
+
+static void dwrr_heap_up(struct dwrr_sched_data *q, int i)
+{
+	struct dwrr_class *cl = q->heap[i];
+	int parent;
+
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (!dwrr_vt_before(cl->finish, (q->heap[parent])->finish))
+			break;
+		dwrr_heap_set(q, i, q->heap[parent]);
+		i = parent;
+	}
+	dwrr_heap_set(q, i, cl);
+}
+
+static void dwrr_heap_down(struct dwrr_sched_data *q, int i)
+{
+	struct dwrr_class *cl = q->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < q->heap_len)
+	{
+		if (child + 1 < q->heap_len &&
+		    dwrr_vt_before((q->heap[child + 1])->finish,
+				   (q->heap[child])->finish))
+			child++;
+		if (!dwrr_vt_before((q->heap[child])->finish, cl->finish))
+			break;
+		dwrr_heap_set(q, i, q->heap[child]);
+		i = child;
+	}
+	dwrr_heap_set(q, i, cl);
+}
+
+static void dwrr_heap_insert(struct dwrr_sched_data *q, struct dwrr_class *cl)
+{
+	dwrr_heap_set(q, q->heap_len++, cl);
+	dwrr_heap_up(q, cl->heap_index);
+}
+
+static void dwrr_heap_remove(struct dwrr_sched_data *q, struct dwrr_class *cl)
+{
+	int i = cl->heap_index;
+	struct dwrr_class *last = q->heap[--q->heap_len];
+
+	cl->heap_index = -1;
+	if (last == cl)
+		return;
+
+	dwrr_heap_set(q, i, last);
+	dwrr_heap_up(q, i);
+	dwrr_heap_down(q, last->heap_index);
+}
+
+/*
+ * Whether the cached threshold of the queue still holds. Thresholds only
+ * change with round time (or the SCFQ weight sum), the round time of the
+ * tenant (inner), the quantum, the share of the DWRR band and the
+ * configuration, so that most packets do not divide. The quantum of a
+ * tenant only changes with a sample of the round time of the port or
+ * with the configuration.
+ */
+static inline bool dwrr_mq_cached(struct dwrr_sched_data *q,
+				  struct dwrr_class *cl,
+				  s64 round,
+				  s64 inner)
+{
+	return likely(cl->mq_round == round &&
+		      cl->mq_inner == inner &&
+		      cl->mq_quantum == cl->quantum &&
+		      cl->mq_gen == q->ecn_gen);
+}
+
+static inline u64 dwrr_mq_cache(struct dwrr_sched_data *q,
+				struct dwrr_class *cl,
+				s64 round,
+				s64 inner,
+				u64 thresh)
+{
+	cl->mq_round = round;
+	cl->mq_inner = inner;
+	cl->mq_quantum = cl->quantum;
+	cl->mq_gen = q->ecn_gen;
+	cl->mq_thresh = thresh;
+	return thresh;
+}
+
+/*
+ * Share of the link in 1/2^20 of a class which sends quantum_ns per round,
+ * i.e., the time to send its quantum over round time, or the band if the
+ * quantum takes as long as the round
+ */
+static inline u64 dwrr_round_share(struct dwrr_sched_data *q,
+				   u64 quantum_ns,
+				   s64 round,
+				   u64 round_inv)
+{
+	if (round > 0 && quantum_ns < round)
+		return (quantum_ns * round_inv) >>
+		       (dwrr_round_inv_shift - dwrr_share_shift);
+
+	return q->band_share;
+}
+
+/*
+ * MQ-ECN ECN marking threshold of the queue. Rounds only serve the DWRR
+ * band, so the rate of the queue is capped by what strict priority queues
+ * leave to the band rather than by the shaping rate. Under SCFQ, the rate
+ * of the queue is its share of the virtual clock, i.e., its weight over
+ * the weights of the active queues, of the band. The share of the link of
+ * a DWRR queue is the time to send its quantum over round time. With
+ * tenants, this is the round of the queues of its tenant, and the share
+ * of the queue is capped by that of the tenant over the round of the port.
+ */
+static u64 dwrr_mq_ecn_thresh(struct dwrr_sched_data *q,
+			      struct dwrr_class *cl)
+{
+	struct dwrr_tenant *t = cl->tenant;
+	u64 share, quantum_ns;
+	s64 round, inner = 0;
+
+	if (cl->heap_index >= 0)
+		round = q->fq_weight_sum;
+	else
+	{
+		round = atomic64_read(&q->port->round_time);
+		if (t)
+			inner = t->round_time;
+	}
+
+	if (dwrr_mq_cached(q, cl, round, inner))
+		return cl->mq_thresh;
+
+	quantum_ns = l2t_ns(&q->rate, cl->quantum);
+	/* quantum / weight sum (at most 1) in 1/2^20, of the band */
+	if (cl->heap_index >= 0 && unlikely(!q->fq_weight_inv))
+		q->fq_weight_inv = dwrr_round_inv(q->fq_weight_sum);
+	if (cl->heap_index >= 0)
+		share = (((cl->quantum * q->fq_weight_inv) >>
+			  (dwrr_round_inv_shift - dwrr_share_shift)) *
+			 q->band_share) >> dwrr_share_shift;
+	else if (t)
+		share = min_t(u64,
+			      dwrr_round_share(q, quantum_ns, inner,
+					       t->round_inv),
+			      dwrr_round_share(q, l2t_ns(&q->rate, t->quantum),
+					       round,
+					       atomic64_read(&q->port->round_inv)));
+	else
+		share = dwrr_round_share(q, quantum_ns, round,
+					 atomic64_read(&q->port->round_inv));
+
+	/* rate <= capacity of the DWRR band */
+	share = min_t(u64, share, q->band_share);
+
+	return dwrr_mq_cache(q, cl, round, inner,
+			     ((u64)q->cfg.port_thresh_bytes * share) >>
+			     dwrr_share_shift);
+}
+
+/*
+ * Sojourn time target of delay-based MQ-ECN. A packet of a backlogged
+ * queue waits for its turn for the part of each round which serves the
+ * other queues, i.e., round_time * (1 - share of the queue). We add this
+ * to the target of the port, so that the target adapts to the link speed
+ * and the quanta without retuning. The queue sends its quantum at the
+ * rate left to the DWRR band. With tenants, the round of the queues of
+ * its tenant, which includes the turns of other tenants, is the wait.
+ */
+static s64 dwrr_mq_ecn_delay_target(struct dwrr_sched_data *q,
+				    struct dwrr_class *cl)
+{
+	s64 round = atomic64_read(&q->port->round_time);
+	s64 round_time = round, inner = 0;
+	s64 quantum_ns;
+
+	if (cl->tenant)
+	{
+		inner = cl->tenant->round_time;
+		round_time = inner;
+	}
+
+	if (dwrr_mq_cached(q, cl, round, inner))
+		return cl->mq_thresh;
+
+	/*
+	 * The quantum takes quantum_ns / band_share. If that is at least the
+	 * round, which includes a band of 0, the queue does not wait. Else
+	 * the product stays below round_time * 2^20.
+	 */
+	quantum_ns = (s64)l2t_ns(&q->rate, cl->quantum);
+	if (q->band_share < (1ULL << dwrr_share_shift))
+	{
+		if ((u64)quantum_ns >=
+		    (((u64)max_t(s64, round_time, 0) * q->band_share) >>
+		     dwrr_share_shift))
+			quantum_ns = round_time;
+		else
+			quantum_ns = ((u64)quantum_ns * q->band_inv) >>
+				     (dwrr_round_inv_shift - dwrr_share_shift);
+	}
+
+	return dwrr_mq_cache(q, cl, round, inner,
+			     q->cfg.target_delay_ns +
+			     max_t(s64, round_time - quantum_ns, 0));
+}
+
+/*
+ * Marking profile over the threshold of the ECN scheme. A ramp runs from
+ * ecn_ramp_min to ecn_ramp_max percent of the threshold, where the marking
+ * probability rises linearly from 0 to 1 (ramp), or to ecn_ramp_prob
+ * percent with every packet marked above the ramp (ramp plus step). Random
+ * marks desynchronize flows which would all see the same step at once.
+ * The percentages are fixed-point fractions precomputed by
+ * dwrr_sched_config(), and a 16-bit random number r is compared without
+ * division: r / 2^16 < (bytes - min) / (max - min) * prob / 2^16. Neither
+ * side overflows below 2^45 bytes or ns.
+ */
+static bool dwrr_ecn_profile_mark(struct dwrr_sched_data *q, u64 bytes,
+				  u64 thresh)
+{
+	u64 min, max;
+
+	if (q->cfg.ecn_profile == dwrr_ecn_step)
+		return bytes > thresh;
+
+	min = (thresh * q->ramp_min) >> dwrr_ecn_ramp_shift;
+	if (bytes <= min)
+		return false;
+	max = (thresh * q->ramp_max) >> dwrr_ecn_ramp_shift;
+	if (bytes > max)
+		return true;
+
+	return (u64)(prandom_u32() & 0xffff) * (max - min) <
+	       (bytes - min) * q->ramp_prob;
+}
+
+/*
+ * Length and threshold of ECN marking: per-queue, per-port, MQ-ECN and
+ * delay-based MQ-ECN. Strict priority queues are not part of rounds, so
+ * MQ-ECN uses the per-queue threshold and delay-based MQ-ECN the target
+ * of the port for them. SCFQ queues do not wait for rounds either, so
+ * their sojourn time is their backlog over their rate, and delay-based
+ * MQ-ECN uses the target of the port for them too. Return false if the
+ * scheme does not mark this packet.
+ */
+static bool dwrr_ecn_thresh(struct dwrr_sched_data *q,
+			    struct dwrr_class *cl,
+			    s64 sojourn,
+			    u64 *bytes,
+			    u64 *thresh)
+{
+	switch (q->cfg.ecn_scheme)
+	{
+		/* Per-queue ECN marking */
+		case dwrr_queue_ecn:
+		{
+			*bytes = cl->len_bytes;
+			*thresh = cl->cfg.thresh_bytes;
+			return true;
+		}
+		/* Per-port ECN marking */
+		case dwrr_port_ecn:
+		{
+			*bytes = atomic_read(&q->port->sum_len_bytes);
+			*thresh = q->cfg.port_thresh_bytes;
+			return true;
+		}
+		/* MQ-ECN */
+		case dwrr_mq_ecn:
+		{
+			*bytes = cl->len_bytes;
+			if (cl->prio > 0)
+				*thresh = cl->cfg.thresh_bytes;
+			else
+				*thresh = dwrr_mq_ecn_thresh(q, cl);
+			return true;
+		}
+		/* Delay-based MQ-ECN */
+		case dwrr_mq_ecn_delay:
+		{
+			if (sojourn < 0)
+				return false;
+			*bytes = sojourn;
+			if (cl->prio > 0 || cl->heap_index >= 0)
+				*thresh = q->cfg.target_delay_ns;
+			else
+				*thresh = dwrr_mq_ecn_delay_target(q, cl);
+			return true;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+/* The threshold of each scheme goes through the marking profile */
+bool dwrr_ecn_marking(struct dwrr_sched_data *q,
+		      struct dwrr_class *cl,
+		      s64 sojourn)
+{
+	u64 bytes, thresh;
+
+	return dwrr_ecn_thresh(q, cl, sojourn, &bytes, &thresh) &&
+	       dwrr_ecn_profile_mark(q, bytes, thresh);
+}
+
+/*
+ * The threshold is computed again only when the tracepoint is enabled. It
+ * comes from the MQ-ECN cache, which the marking decision has just filled.
+ */
+void dwrr_ecn_marked(struct dwrr_sched_data *q,
+		     struct dwrr_class *cl,
+		     s64 sojourn)
+{
+	u64 bytes = 0, thresh = 0;
+
+	dwrr_stats_add(cl, marks, 1);
+	if (trace_dwrr_mark_enabled())
+	{
+		dwrr_ecn_thresh(q, cl, sojourn, &bytes, &thresh);
+		trace_dwrr_mark(q, cl, bytes, thresh);
+	}
+}
+
+/*
+ * Dynamic threshold: the part of the packet beyond the guaranteed buffer
+ * of the queue goes to the shared pool, in which the queue may hold at
+ * most alpha times the free space. As the pool fills up, the limit of
+ * every queue shrinks, which leaves room for queues becoming active.
+ */
+static bool dwrr_dt_overfill(unsigned int len,
+			     struct dwrr_class *cl,
+			     struct dwrr_sched_data *q)
+{
+	s64 over, free;
+
+	over = (s64)cl->len_bytes - cl->shared_bytes + len -
+	       cl->cfg.guarantee_bytes;
+	if (over <= 0)
+		return false;
+
+	over = min_t(s64, over, len);
+	free = (s64)q->cfg.shared_buffer_bytes -
+	       atomic_read(&q->port->shared_len_bytes);
+	if (over > free)
+		return true;
+
+	return cl->shared_bytes + over >
+	       ((free * cl->cfg.alpha) >> dwrr_dt_alpha_shift);
+}
+
+bool dwrr_buffer_overfill(unsigned int len,
+			  struct dwrr_class *cl,
+			  struct dwrr_sched_data *q)
+{
+	/*
+	 * per-port shared buffer. Schedulers of the same port check and
+	 * update the occupancy without a lock, so the port may exceed the
+	 * buffer by at most one packet per scheduler.
+	 */
+	if (q->cfg.buffer_mode == dwrr_shared_buffer &&
+	    atomic_read(&q->port->sum_len_bytes) + len >
+	    q->cfg.shared_buffer_bytes)
+		return true;
+	/* per-queue static buffer */
+	else if (q->cfg.buffer_mode == dwrr_static_buffer &&
+		 cl->len_bytes + len > cl->cfg.buffer_bytes)
+		return true;
+	else if (q->cfg.buffer_mode == dwrr_dt_buffer)
+		return dwrr_dt_overfill(len, cl, q);
+	else
+		return false;
+}
+
+/* Decide whether the packet can be transmitted according to Token Bucket */
+static s64 tbf_schedule(unsigned int len, struct dwrr_sched_data *q, s64 now)
+{
+	s64 pkt_ns, toks;
+	s64 bucket_ns = dwrr_bucket_ns(q);
+
+	toks = now - q->time_ns;
+	/* Pay the debt of a packet larger than the bucket first */
+	if (q->tokens < 0)
+		toks = min_t(s64, toks + q->tokens, bucket_ns);
+	else
+		toks = min_t(s64, toks, bucket_ns) + q->tokens;
+
+	pkt_ns = (s64)l2t_ns(&q->rate, len);
+
+	return toks - min_t(s64, pkt_ns, bucket_ns);
+}
+
+void dwrr_idle_update(struct dwrr_sched_data *q, s64 now)
+{
+	struct dwrr_port *port = q->port;
+	s64 interval, idle = q->cfg.idle_interval_ns;
+	u64 n;
+	int i;
+
+	if (atomic_read(&port->sum_len_bytes) > 0 ||
+	    (q->cfg.ecn_scheme != dwrr_mq_ecn &&
+	     q->cfg.ecn_scheme != dwrr_mq_ecn_delay) ||
+	    idle <= 0)
+		return;
+
+	interval = now - atomic64_read(&port->last_idle_time);
+	if (interval < idle)
+		return;
+
+	if (interval >= (dwrr_max_iteration + 1) * idle)
+	{
+		dwrr_round_set(port, 0);
+		for (i = 0; i < q->num_tenants; i++)
+			dwrr_tenant_round_set(&(q->tenants[i]), 0);
+		return;
+	}
+
+	/* interval / idle, which the reciprocal gives at most one too small */
+	n = ((u64)interval * q->idle_inv) >> 40;
+	if ((n + 1) * idle <= interval)
+		n++;
+
+	dwrr_round_decay(q, n);
+}
+
+/* Slow path of dwrr_flow_next(): the deficit of the head flow is used up */
+int dwrr_flow_rotate(struct dwrr_class *cl)
+{
+	struct dwrr_flow *f;
+	int i;
+
+	while ((i = cl->flow_head) >= 0)
+	{
+		f = &(cl->flows[i]);
+		if (f->deficit > 0)
+			break;
+
+		/* Move on to the next active flow with a new quantum */
+		f->deficit += dwrr_fq_quantum;
+		if (f->next >= 0)
+		{
+			cl->flow_head = f->next;
+			(cl->flows[cl->flow_tail]).next = i;
+			cl->flow_tail = i;
+			f->next = -1;
+		}
+	}
+
+	return i;
+}
+
+/* Append flow i of cl to the active flows if it is empty */
+static void dwrr_flow_enqueue(struct dwrr_class *cl,
+			      int i,
+			      unsigned int len)
+{
+	struct dwrr_flow *f = &(cl->flows[i]);
+
+	if (f->len_bytes == 0)
+	{
+		f->deficit = dwrr_fq_quantum;
+		f->next = -1;
+		if (cl->flow_tail >= 0)
+			(cl->flows[cl->flow_tail]).next = i;
+		else
+			cl->flow_head = i;
+		cl->flow_tail = i;
+	}
+
+	f->len_bytes += len;
+}
+
+/* The head packet of the flow served now has left */
+static void dwrr_flow_dequeue(struct dwrr_class *cl, unsigned int len)
+{
+	struct dwrr_flow *f = &(cl->flows[cl->flow_head]);
+
+	f->deficit -= len;
+	f->len_bytes -= len;
+	if (f->len_bytes == 0)
+	{
+		cl->flow_head = f->next;
+		if (cl->flow_head < 0)
+			cl->flow_tail = -1;
+	}
+}
+
+/* A queue of tenant t has become active */
+static inline void dwrr_tenant_enqueue(struct dwrr_sched_data *q,
+				       struct dwrr_tenant *t,
+				       s64 now)
+{
+	if (t->active++ > 0)
+		return;
+
+	t->start_time = now;
+	t->quantum = t->next_quantum;
+	t->deficit = t->quantum;
+	__set_bit(t->id, q->tenant_active);
+}
+
+/* A queue of tenant t has become empty */
+static inline void dwrr_tenant_dequeue(struct dwrr_sched_data *q,
+				       struct dwrr_tenant *t)
+{
+	if (--t->active > 0)
+		return;
+
+	/* The next active tenant goes first even if t is refilled */
+	__clear_bit(t->id, q->tenant_active);
+	q->tenant_cursor = t->id + 1;
+	dwrr_round_update(q, t->id, t->last_pkt_time - t->start_time);
+}
+
+void dwrr_enqueue_update(struct dwrr_sched_data *q,
+			 struct dwrr_class *cl,
+			 int flow,
+			 unsigned int len,
+			 s64 now)
+{
+	/*
+	 * If the queue is empty, insert it to the active set of its band. The
+	 * level is kept until the queue is empty again.
+	 */
+	if (cl->len_bytes == 0)
+	{
+		cl->prio = cl->cfg.prio;
+		if (cl->prio > 0)
+		{
+			__set_bit(cl->id, q->sp_active);
+			if (q->sp_count[cl->prio]++ == 0)
+				q->sp_levels |= 1U << cl->prio;
+		}
+		else if (q->cfg.sched_mode == dwrr_mode_scfq)
+		{
+			cl->quantum = cl->cfg.quantum;
+			if (dwrr_vt_before(cl->finish, q->vtime))
+				cl->finish = q->vtime;
+			cl->finish += len * cl->inv_weight;
+			dwrr_fq_weight_add(q, cl->quantum);
+			dwrr_heap_insert(q, cl);
+		}
+		else
+		{
+			cl->start_time = now;
+			cl->quantum = cl->cfg.quantum;
+			cl->deficit = cl->quantum;
+			__set_bit(cl->id, q->active);
+			if (cl->tenant)
+				dwrr_tenant_enqueue(q, cl->tenant, now);
+		}
+	}
+
+	/* Update queue sizes */
+	atomic_add(len, &q->port->sum_len_bytes);
+	cl->len_bytes += len;
+	dwrr_flow_enqueue(cl, flow, len);
+	dwrr_dt_charge(q, cl, len);
+	dwrr_stats_add(cl, enq_bytes, len);
+	dwrr_stats_add(cl, enq_pkts, 1);
+
+	trace_dwrr_enqueue(q, cl, len);
+}
+
+/*
+ * The active queue at or after the cursor, in round robin order of queue
+ * index, or NULL if no queue is active
+ */
+static inline struct dwrr_class *dwrr_active_next(struct dwrr_sched_data *q)
+{
+	int n = q->cfg.num_queues;
+	int i = find_next_bit(q->active, n, q->cursor);
+
+	if (i >= n)
+	{
+		i = find_first_bit(q->active, n);
+		if (i >= n)
+			return NULL;
+	}
+
+	q->cursor = i;
+	return &(q->queues[i]);
+}
+
+/*
+ * With tenants, the active queue at or after the cursor of the active
+ * tenant at or after the tenant cursor, or NULL if no queue is active
+ */
+static inline struct dwrr_class *dwrr_tenant_next(struct dwrr_sched_data *q)
+{
+	int n = q->num_tenants;
+	int i = find_next_bit(q->tenant_active, n, q->tenant_cursor);
+	struct dwrr_tenant *t;
+
+	if (i >= n)
+	{
+		i = find_first_bit(q->tenant_active, n);
+		if (i >= n)
+			return NULL;
+	}
+
+	q->tenant_cursor = i;
+	t = &(q->tenants[i]);
+	/* An active tenant has an active queue */
+	i = find_next_bit(q->active, t->last, t->cursor);
+	if (i >= t->last)
+		i = find_next_bit(q->active, t->last, t->first);
+
+	t->cursor = i;
+	return &(q->queues[i]);
+}
+
+/* The first active strict priority queue of the highest level, or NULL */
+static inline struct dwrr_class *dwrr_sp_next(struct dwrr_sched_data *q)
+{
+	int n = q->cfg.num_queues;
+	int prio, i;
+
+	if (likely(!q->sp_levels))
+		return NULL;
+
+	prio = fls64(q->sp_levels) - 1;
+	for (i = find_first_bit(q->sp_active, n); i < n;
+	     i = find_next_bit(q->sp_active, n, i + 1))
+	{
+		if ((q->queues[i]).prio == prio)
+			return &(q->queues[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Update the rate estimation of strict priority queues at the end of each
+ * window. It is only computed while there is strict priority traffic.
+ */
+static inline void dwrr_sp_rate_update(struct dwrr_sched_data *q, s64 now)
+{
+	s64 interval = now - q->sp_time;
+	u64 sample;
+
+	if (interval < dwrr_sp_window_ns)
+		return;
+
+	if (q->sp_bytes > 0 || q->sp_rate_bps > 0)
+	{
+		sample = div64_u64(q->sp_bytes * 8 * NSEC_PER_SEC, interval);
+		q->sp_rate_bps = s64_ewma((s64)q->sp_rate_bps, (s64)sample,
+					  q->cfg.round_alpha,
+					  dwrr_round_alpha_shift);
+		dwrr_band_share_update(q);
+	}
+
+	q->sp_bytes = 0;
+	q->sp_time = now;
+}
+
+/* The head packet of cl waits for tokens */
+static inline void dwrr_throttle(struct dwrr_sched_data *q,
+				 struct dwrr_class *cl)
+{
+	q->throttled = cl;
+	dwrr_stats_add(cl, overlimits, 1);
+}
+
+void dwrr_watchdog_armed(struct dwrr_sched_data *q, s64 delay)
+{
+	struct dwrr_class *cl = q->throttled;
+
+	if (unlikely(!cl))
+		return;
+
+	dwrr_stats_add(cl, watchdogs, 1);
+	trace_dwrr_watchdog(q, cl, dwrr_class_head_len(cl), delay);
+}
+
+struct dwrr_class *dwrr_schedule(struct dwrr_sched_data *q,
+				 s64 now,
+				 unsigned int *len,
+				 s64 *result)
+{
+	struct dwrr_class *cl = NULL;
+	struct dwrr_tenant *t;
+	s64 sample;
+
+	*result = 0;
+
+	/*
+	 * Strict priority queues go first, then SCFQ queues. Neither has
+	 * deficit.
+	 */
+	cl = dwrr_sp_next(q);
+	if (!cl && q->heap_len > 0)
+		cl = q->heap[0];
+	if (cl)
+	{
+		*len = dwrr_class_head_len(cl);
+		if (unlikely(*len == 0))
+			return NULL;
+
+		*result = tbf_schedule(*len, q, now);
+		if (*result < 0)
+		{
+			dwrr_throttle(q, cl);
+			return NULL;
+		}
+
+		return cl;
+	}
+
+	while (1)
+	{
+		if (q->num_tenants > 0)
+			cl = dwrr_tenant_next(q);
+		else
+			cl = dwrr_active_next(q);
+		/* No active queue */
+		if (!cl)
+			return NULL;
+
+		/* get head packet */
+		t = cl->tenant;
+		*len = dwrr_class_head_len(cl);
+		if (unlikely(*len == 0))
+			return NULL;
+
+		/* If this packet can be scheduled by DWRR */
+		if (*len <= cl->deficit && (!t || *len <= t->deficit))
+		{
+			*result = tbf_schedule(*len, q, now);
+			/* If we don't have enough tokens */
+			if (*result < 0)
+			{
+				dwrr_throttle(q, cl);
+				return NULL;
+			}
+
+			return cl;
+		}
+		/* Serve a large GSO packet segment by segment */
+		else if (q->cfg.gso_split == dwrr_enable &&
+			 dwrr_class_head_split(q, cl) > 0)
+		{
+			continue;
+		}
+		/* This packet can not be scheduled by DWRR */
+		else if (*len > cl->deficit)
+		{
+			sample = cl->last_pkt_time - cl->start_time;
+			if (t)
+				dwrr_tenant_round_update(q, t, cl->id, sample);
+			else
+				dwrr_round_update(q, cl->id, sample);
+			cl->start_time = cl->last_pkt_time;
+			cl->quantum = cl->cfg.quantum;
+			/* Move on to the next active queue (of the tenant) */
+			if (t)
+				t->cursor = cl->id + 1;
+			else
+				q->cursor = cl->id + 1;
+
+			/*
+			 * WRR. A GSO packet may be larger than the quantum,
+			 * and must still fit the next turn.
+			 */
+			if (q->cfg.enable_wrr == dwrr_enable)
+				cl->deficit = max_t(u32, cl->quantum, *len);
+			/* DWRR */
+			else
+				cl->deficit += cl->quantum;
+		}
+		/*
+		 * The tenant has used up its deficit. Its queues keep theirs
+		 * and its cursor for its next turn.
+		 */
+		else
+		{
+			sample = t->last_pkt_time - t->start_time;
+			dwrr_round_update(q, t->id, sample);
+			t->start_time = t->last_pkt_time;
+			t->quantum = t->next_quantum;
+			/* Move on to the next active tenant */
+			q->tenant_cursor = t->id + 1;
+
+			if (q->cfg.enable_wrr == dwrr_enable)
+				t->deficit = max_t(u32, t->quantum, *len);
+			else
+				t->deficit += t->quantum;
+		}
+	}
+
+	return NULL;
+}
+
+void dwrr_dequeue_update(struct dwrr_sched_data *q,
+			 struct dwrr_class *cl,
+			 unsigned int len,
+			 s64 now,
+			 s64 result)
+{
+	struct dwrr_tenant *t;
+	s64 sample;
+	s64 bucket_ns = dwrr_bucket_ns(q);
+	bool port_idle;
+
+	port_idle = atomic_sub_return(len, &q->port->sum_len_bytes) == 0;
+	cl->len_bytes -= len;
+	dwrr_flow_dequeue(cl, len);
+	dwrr_dt_release(q, cl, len);
+	cl->last_pkt_time = now + l2t_ns(&q->rate, len);
+	dwrr_stats_add(cl, deq_bytes, len);
+	dwrr_stats_add(cl, deq_pkts, 1);
+	trace_dwrr_dequeue(q, cl, len);
+
+	if (cl->prio > 0)
+	{
+		q->sp_bytes += len;
+		if (cl->len_bytes == 0)
+		{
+			__clear_bit(cl->id, q->sp_active);
+			if (--q->sp_count[cl->prio] == 0)
+				q->sp_levels &= ~(1U << cl->prio);
+		}
+	}
+	/* The virtual time is the finish time of the packet in service */
+	else if (cl->heap_index >= 0)
+	{
+		q->vtime = cl->finish;
+		if (cl->len_bytes == 0)
+		{
+			dwrr_heap_remove(q, cl);
+			dwrr_fq_weight_add(q, -(s64)cl->quantum);
+		}
+		else
+		{
+			cl->finish += dwrr_class_head_len(cl) * cl->inv_weight;
+			dwrr_heap_down(q, cl->heap_index);
+		}
+	}
+	else if (cl->tenant)
+	{
+		t = cl->tenant;
+		cl->deficit -= len;
+		t->deficit -= len;
+		t->last_pkt_time = cl->last_pkt_time;
+		if (cl->len_bytes == 0)
+		{
+			__clear_bit(cl->id, q->active);
+			t->cursor = cl->id + 1;
+			sample = cl->last_pkt_time - cl->start_time;
+			dwrr_tenant_round_update(q, t, cl->id, sample);
+			dwrr_tenant_dequeue(q, t);
+		}
+	}
+	else
+	{
+		cl->deficit -= len;
+		if (cl->len_bytes == 0)
+		{
+			/*
+			 * The next active queue goes first even if cl is
+			 * refilled
+			 */
+			__clear_bit(cl->id, q->active);
+			q->cursor = cl->id + 1;
+			sample = cl->last_pkt_time - cl->start_time;
+			dwrr_round_update(q, cl->id, sample);
+		}
+	}
+
+	/* Get start time of idle period */
+	if (port_idle)
+		atomic64_set(&q->port->last_idle_time, now);
+	dwrr_sp_rate_update(q, now);
+
+	/* Bucket. The part of the packet beyond the bucket is a debt. */
+	q->time_ns = now;
+	q->tokens = min_t(s64, result, bucket_ns) -
+		    max_t(s64, (s64)l2t_ns(&q->rate, len) - bucket_ns, 0);
+}
@@ -0,0 +1,681 @@
+#ifndef __DWRR_H__
+#define __DWRR_H__
+
+#include "compat.h"
+#include "params.h"
+
+/*
+ * DWRR/MQ-ECN scheduling core. Everything in this header and in dwrr.c is
+ * independent of sk_buff and Qdisc so that it can be built both into the
+ * kernel module (main.c) and into the userspace simulator (sim/).
+ * All functions take the current time in ns from the caller.
+ */
+
+struct dwrr_rate_cfg
+{
+	u64	rate_bps;
+	u32	mult;
+	u32	shift;
+};
+
+/**
+ *	struct dwrr_port - state shared by all the schedulers of a switch port
+ *	@sum_len_bytes: the total buffer occupancy (in bytes) of the switch port
+ *	@shared_len_bytes: occupancy (in bytes) of the shared pool of dynamic
+ *	threshold, i.e., bytes of queues beyond their guaranteed buffer
+ *	@round_time: estimation of round time in ns
+ *	@round_inv: 2^40 / round_time, or 0, so that MQ-ECN does not divide
+ *	@last_idle_time: last time when the port is idle
+ *
+ *	With mq, one scheduler is attached to each hardware TX queue and they
+ *	run concurrently on different CPUs. Buffer occupancy, which is updated
+ *	for every packet, and round time, which is updated once per round, are
+ *	kept on different cache lines.
+ */
+struct dwrr_port
+{
+	atomic_t	sum_len_bytes ____cacheline_aligned_in_smp;
+	atomic_t	shared_len_bytes;
+
+	atomic64_t	round_time ____cacheline_aligned_in_smp;
+	atomic64_t	round_inv;
+	atomic64_t	last_idle_time;
+};
+
+/*
+ * Sojourn time histogram. Buckets 0-3 count 0-3 ns. Above, each power of
+ * two [2^k, 2^(k+1)) is split into 4 buckets of the same width, so that
+ * the relative error is at most 25%. Bucket 4 * (k - 1) + m counts
+ * [2^k + m * 2^(k-2), 2^k + (m + 1) * 2^(k-2)) ns. The last bucket
+ * (about 8s and above) also counts anything longer.
+ */
+#define dwrr_hist_buckets 128
+
+/**
+ *	struct dwrr_class_stats - per queue counters of a CPU
+ *	@syncp: consistent reads of 64-bit counters on 32-bit hosts
+ *	@enq_bytes: wire bytes accepted by the queue
+ *	@enq_pkts: packets accepted by the queue
+ *	@deq_bytes: wire bytes transmitted by the queue
+ *	@deq_pkts: packets transmitted by the queue
+ *	@drops: packets dropped because the buffer is overfilled
+ *	@marks: packets marked with CE
+ *	@overlimits: dequeues of the head packet delayed by the rate limiter
+ *	@watchdogs: rate limiter timers armed for the head packet
+ *
+ *	Each CPU counts in its own copy, so that enqueue and dequeue on
+ *	different CPUs do not bounce the cache line of the counters. Copies
+ *	are only summed by dwrr_class_stats_read() when statistics are read.
+ *	Enqueue, dequeue and overlimits are counted by the core. Drops are
+ *	counted by the caller, which decides what to do with the packet.
+ *	Marks and watchdogs are counted by dwrr_ecn_marked() and
+ *	dwrr_watchdog_armed(), once the caller has set CE or armed the timer.
+ */
+struct dwrr_class_stats
+{
+	struct u64_stats_sync	syncp;
+	u64	enq_bytes;
+	u64	enq_pkts;
+	u64	deq_bytes;
+	u64	deq_pkts;
+	u64	drops;
+	u64	marks;
+	u64	overlimits;
+	u64	watchdogs;
+};
+
+/**
+ *	struct dwrr_flow - a flow sub-queue of a class
+ *	@skbs: FIFO queue to store sk_buff (kernel only)
+ *	@deficit: deficit counter of this flow (bytes), which may be negative
+ *	@len_bytes: length of this flow in bytes
+ *	@next: the next active flow of the class, or -1
+ */
+struct dwrr_flow
+{
+#ifdef __KERNEL__
+	struct sk_buff_head	skbs;
+#endif
+	int	deficit;
+	u32	len_bytes;
+	int	next;
+};
+
+/**
+ *	struct dwrr_tenant - a tenant, i.e., consecutive queues of the DWRR
+ *	band which share the weight of the tenant
+ *
+ *	@id: tenant ID
+ *	@first: the first queue of this tenant
+ *	@last: the queue after the last queue of this tenant
+ *	@cursor: the queue of this tenant served in its round
+ *	@active: the number of active round robin queues of this tenant
+ *	@deficit: deficit counter of this tenant (bytes)
+ *	@quantum: quantum in bytes of this tenant (in this round)
+ *	@next_quantum: quantum of the next rounds, @cfg.quantum or the sum of
+ *	the quanta of its DWRR queues (at least a packet)
+ *	@start_time: time when this tenant is inserted to the active set
+ *	@last_pkt_time: time when this tenant transmits the last packet
+ *	@round_time: estimation of the round time of its queues in ns
+ *	@round_inv: 2^40 / @round_time, or 0
+ *	@cfg: configuration of this tenant
+ *
+ *	Tenants take turns with deficit round robin over the port, as queues
+ *	do without tenants, and the port round time is sampled per tenant.
+ *	The queues of a tenant take turns inside the share of the tenant, and
+ *	keep their position while other tenants are served.
+ */
+struct dwrr_tenant
+{
+	int	id;
+	int	first;
+	int	last;
+	int	cursor;
+	int	active;
+	u32	deficit;
+	u32	quantum;
+	u32	next_quantum;
+	s64	start_time;
+	s64	last_pkt_time;
+	s64	round_time;
+	u64	round_inv;
+
+	struct dwrr_tenant_cfg	cfg;
+};
+
+/**
+ *	struct dwrr_class - a Class of Service (CoS) queue
+ *
+ *	@id: queue ID
+ *	@deficit: deficit counter of this queue (bytes)
+ *	@len_bytes: queue length in bytes
+ *	@shared_bytes: bytes of this queue held in the shared pool of dynamic
+ *	threshold. The rest of @len_bytes is in its guaranteed buffer.
+ *	@flow_head: the active flow served now, or -1 if the class is empty
+ *	@flow_tail: the last active flow, or -1
+ *	@quantum: quantum in bytes of this queue (in this round)
+ *	@prio: strict priority level of this queue while it is active
+ *	@last_pkt_time: time when this queue transmits the last packet
+ *	@tenant: tenant of this queue, or NULL without tenants
+ *	@stats: per-CPU counters of this queue
+ *	@flows: flow sub-queues. Packets are stored by the user of the core,
+ *	one FIFO per flow. Without fair queueing, all of them go to flow 0.
+ *	@mq_thresh: cached MQ-ECN threshold (bytes) or delay target (ns)
+ *	@mq_round: round time (or SCFQ weight sum) @mq_thresh comes from
+ *	@mq_inner: round time of the tenant @mq_thresh comes from
+ *	@mq_quantum: quantum @mq_thresh comes from
+ *	@mq_gen: value of ecn_gen of the scheduler @mq_thresh comes from
+ *	@cfg: configuration of this queue
+ *	@heap_index: position in the SCFQ heap, or -1 if not there
+ *	@flow: @flows of a queue which has never had fair queueing. The user
+ *	of the core attaches dwrr_fq_flows flows of its own with
+ *	dwrr_flows_attach() before fair queueing is enabled for the queue.
+ *	@start_time: time when this queue is inserted to the active set
+ *	@finish: SCFQ virtual finish time of the head (or the last) packet
+ *	@inv_weight: 2^32 / @cfg.quantum, the virtual time of a byte under
+ *	SCFQ, set by dwrr_sched_config()
+ *	@sojourn: histogram of sojourn time (enqueue to dequeue) in ns. It is
+ *	too large to have a copy per CPU, and only dequeue updates it.
+ *
+ *	Each queue starts on its own cache line. The fields every packet
+ *	touches come first and fill one line, and the MQ-ECN cache and the
+ *	configuration read by enqueue fill the next one. @flow shares the
+ *	third line with the fields of round sampling and SCFQ, so that a
+ *	packet of a queue without fair queueing touches three lines of its
+ *	class, and one with fair queueing two lines and its flow. @sojourn is
+ *	last, as it is only read by statistics dumps outside of dequeue.
+ */
+struct dwrr_class
+{
+	/* Every packet */
+	int	id ____cacheline_aligned_in_smp;
+	u32	deficit;
+	u32	len_bytes;
+	u32	shared_bytes;
+	int	flow_head;
+	int	flow_tail;
+	u32	quantum;
+	int	prio;
+	s64	last_pkt_time;
+	struct dwrr_tenant	*tenant;
+	struct dwrr_class_stats	__percpu *stats;
+	struct dwrr_flow	*flows;
+
+	/* Enqueue: ECN marking and buffer management */
+	u64	mq_thresh;
+	s64	mq_round;
+	s64	mq_inner;
+	u32	mq_quantum;
+	u32	mq_gen;
+	struct dwrr_queue_cfg	cfg;
+	int	heap_index;
+
+	/* The single flow, round sampling and SCFQ */
+	struct dwrr_flow	flow;
+	s64	start_time;
+	u64	finish;
+	u64	inv_weight;
+
+	/* Statistics */
+	u64	sojourn[dwrr_hist_buckets];
+};
+
+struct dwrr_snapshot;
+
+/**
+ *	struct dwrr_sched_data - DWRR scheduler
+ *	@queues: multiple Class of Service (CoS) queues (cfg.num_queues)
+ *	@stats: per-CPU counters of the queues
+ *	@port: switch port this scheduler belongs to
+ *	@rate: shaping rate
+ *	@active: bitmap of active queues of the DWRR band
+ *	@cursor: the queue served in this round, in round robin order of index
+ *	@sp_active: bitmap of active strict priority queues
+ *	@sp_levels: bit i is set if a queue of strict priority level i is active
+ *	@sp_count: the number of active queues of each strict priority level
+ *	@heap: min-heap of active SCFQ queues ordered by finish time
+ *	@heap_len: the number of queues in @heap
+ *	@vtime: SCFQ virtual time, the finish time of the last packet
+ *	@fq_weight_sum: the sum of the quanta of the queues in @heap
+ *	@fq_weight_inv: 2^40 / @fq_weight_sum, or 0 until MQ-ECN needs it
+ *	after @fq_weight_sum has changed
+ *	@tenants: tenants of the DWRR band, or NULL without tenants
+ *	@num_tenants: the number of tenants, or 0
+ *	@tenant_active: bitmap of active tenants
+ *	@tenant_cursor: the tenant served in this round
+ *	@throttled: the queue whose head packet the rate limiter has delayed
+ *	at the last dwrr_schedule()
+ *	@watchdog: watchdog timer for token bucket rate limiter (kernel only)
+ *	@ready: packets released by the last dequeue pass (kernel only)
+ *	@list: linked list of all the instances (kernel only)
+ *	@snap: configuration published by sysctl and netlink writers (kernel
+ *	only)
+ *	@snap_gen: generation of @snap copied to @cfg, @rate and the
+ *	configuration of the queues and the tenants (kernel only)
+ *	@node: NUMA node of the memory of this instance (kernel only)
+ *	@cfg: configuration of this instance. Its scalar parameters fill one
+ *	cache line.
+ *
+ *	@tokens: tokens in ns
+ *	@time_ns: time check-point
+ *
+ *	@sp_rate_bps: rate estimation of the strict priority queues
+ *	@sp_bytes: bytes sent by strict priority queues in this window
+ *	@sp_time: start time of this window
+ *
+ *	Derived from @cfg and @rate by dwrr_sched_config():
+ *	@band_share: rate of the DWRR band over the shaping rate in 1/2^20
+ *	@band_inv: 2^40 / @band_share, or 0
+ *	@ecn_gen: incremented when cached MQ-ECN thresholds become stale
+ *	@idle_inv: 2^40 / idle_interval_ns
+ *	@ramp_min: start of the ECN ramp in 1/2^16 of the threshold
+ *	@ramp_max: end of the ECN ramp in 1/2^16 of the threshold
+ *	@ramp_prob: marking probability at the end of the ramp in 1/2^16
+ *	@idle_decay: round time decay after n idle intervals (alpha^n) in
+ *	1/2^20
+ *
+ *	Fields are grouped by cache line: what picks the next queue, what the
+ *	rate limiter writes for every packet, the packets released by a
+ *	dequeue pass with the SCFQ heap, and @cfg. Fields only written when a
+ *	queue becomes active or idle, or by configuration, come last.
+ */
+struct dwrr_sched_data
+{
+	/* Queue selection */
+	struct dwrr_class	*queues ____cacheline_aligned_in_smp;
+	struct dwrr_class_stats	__percpu *stats;
+	struct dwrr_port	*port;
+	unsigned long		*active;
+	struct dwrr_tenant	*tenants;
+	unsigned long		*tenant_active;
+	int			cursor;
+	int			tenant_cursor;
+	u32			sp_levels;
+	u32			ecn_gen;
+
+	/* Rate limiter and bandwidth of the DWRR band */
+	s64			tokens ____cacheline_aligned_in_smp;
+	s64			time_ns;
+	struct dwrr_rate_cfg	rate;
+	struct dwrr_class	*throttled;
+	u64			band_share;
+	u64			band_inv;
+	u64			sp_bytes;
+	s64			sp_time;
+
+#ifdef __KERNEL__
+	struct sk_buff_head	ready ____cacheline_aligned_in_smp;
+	struct dwrr_snapshot	__rcu *snap;
+	u32			snap_gen;
+#endif
+	int			heap_len;
+	unsigned long		*sp_active;
+	struct dwrr_class	**heap;
+	u64			vtime;
+
+	struct dwrr_config	cfg ____cacheline_aligned_in_smp;
+
+	/* Queue activation and configuration */
+	u64			fq_weight_sum ____cacheline_aligned_in_smp;
+	u64			fq_weight_inv;
+	u64			sp_rate_bps;
+	int			sp_count[dwrr_max_prio + 1];
+	int			num_tenants;
+	u64			idle_inv;
+	u32			ramp_min;
+	u32			ramp_max;
+	u32			ramp_prob;
+	u32			idle_decay[dwrr_max_iteration + 1];
+#ifdef __KERNEL__
+	struct qdisc_watchdog	watchdog;
+	struct list_head	list;
+	int			node;
+#endif
+};
+
+/*
+ * We use this function to account for the true number of bytes sent on wire.
+ * 20 = frame check sequence(8B)+Interpacket gap(12B)
+ * 4 = Frame check sequence (4B)
+ * dwrr_min_pkt_bytes = Minimum Ethernet frame size (64B)
+ */
+static inline unsigned int dwrr_wire_bytes(unsigned int len)
+{
+	return max_t(unsigned int, len + 4, dwrr_min_pkt_bytes) + 20;
+}
+
+/*
+ * Wire bytes of a GSO packet sent as segs frames, where len is the total
+ * length of the frames (headers of every segment included). Each segment
+ * pays its own FCS, padding and interpacket gap.
+ */
+static inline unsigned int dwrr_gso_wire_bytes(unsigned int len,
+					       unsigned int segs)
+{
+	return max_t(unsigned int, len + 4 * segs, dwrr_min_pkt_bytes * segs) +
+	       20 * segs;
+}
+
+/* Borrow from ptb: length (bytes) to time (nanosecond) */
+static inline u64 l2t_ns(struct dwrr_rate_cfg *r, unsigned int len_bytes)
+{
+	return ((u64)len_bytes * r->mult) >> r->shift;
+}
+
+/*
+ * Bandwidth left to the DWRR band by the strict priority queues. MQ-ECN
+ * derives the thresholds of DWRR queues from it rather than from the
+ * shaping rate.
+ */
+static inline u64 dwrr_band_rate(struct dwrr_sched_data *q)
+{
+	if (q->sp_rate_bps >= q->rate.rate_bps)
+		return 0;
+	return q->rate.rate_bps - q->sp_rate_bps;
+}
+
+/* Size in longs of the active bitmaps of n queues (and of their tenants) */
+#define dwrr_bitmap_longs(n) (3 * BITS_TO_LONGS(n))
+
+/* The number of tenants of an instance, or 0 without tenants */
+static inline int dwrr_num_tenants(struct dwrr_config *cfg)
+{
+	if (cfg->tenant_queues <= 0)
+		return 0;
+
+	return DIV_ROUND_UP(cfg->num_queues, cfg->tenant_queues);
+}
+
+/*
+ * Length in wire bytes of the head packet of the class, or 0 if the class
+ * is empty. The core does not store packets, so each user of the core
+ * (the qdisc or the simulator) provides this. The head packet of the class
+ * is the head packet of flow dwrr_flow_next(cl).
+ */
+unsigned int dwrr_class_head_len(struct dwrr_class *cl);
+
+/*
+ * Replace the head packet of cl, if it is a GSO packet, with its segments
+ * and account for them with dwrr_class_resize(). Return the wire length of
+ * the new head packet, or 0 if the head packet has not been segmented.
+ * Provided by each user of the core, like dwrr_class_head_len().
+ */
+unsigned int dwrr_class_head_split(struct dwrr_sched_data *q,
+				   struct dwrr_class *cl);
+
+/*
+ * Add val to a counter of cl on this CPU. Callers do not migrate (the
+ * qdisc runs with BH disabled).
+ */
+#define dwrr_stats_add(cl, field, val)					\
+	do								\
+	{								\
+		struct dwrr_class_stats *__st = this_cpu_ptr((cl)->stats); \
+									\
+		u64_stats_update_begin(&__st->syncp);			\
+		__st->field += (val);					\
+		u64_stats_update_end(&__st->syncp);			\
+	} while (0)
+
+/* Sum the counters of cl over all the CPUs */
+void dwrr_class_stats_read(struct dwrr_class *cl, struct dwrr_class_stats *sum);
+
+/*
+ * Dynamic threshold accounting of len bytes added to cl, which go to its
+ * guaranteed buffer first and then to the shared pool. The caller has
+ * already added them to cl->len_bytes.
+ */
+static inline void dwrr_dt_charge(struct dwrr_sched_data *q,
+				  struct dwrr_class *cl,
+				  unsigned int len)
+{
+	s64 over;
+
+	if (q->cfg.buffer_mode != dwrr_dt_buffer)
+		return;
+
+	over = (s64)cl->len_bytes - cl->shared_bytes - cl->cfg.guarantee_bytes;
+	if (over <= 0)
+		return;
+
+	over = min_t(s64, over, len);
+	cl->shared_bytes += over;
+	atomic_add(over, &q->port->shared_len_bytes);
+}
+
+/*
+ * len bytes of cl have left. Bytes in the shared pool are given back
+ * first, whatever the buffer mode, so that nothing is left in the pool
+ * after the mode has changed.
+ */
+static inline void dwrr_dt_release(struct dwrr_sched_data *q,
+				   struct dwrr_class *cl,
+				   unsigned int len)
+{
+	u32 shared = min_t(u32, cl->shared_bytes, len);
+
+	if (shared == 0)
+		return;
+
+	cl->shared_bytes -= shared;
+	atomic_sub(shared, &q->port->shared_len_bytes);
+}
+
+/*
+ * The packets of cl have grown by delta wire bytes (which may be negative)
+ * because its head packet has been segmented.
+ */
+static inline void dwrr_class_resize(struct dwrr_sched_data *q,
+				     struct dwrr_class *cl,
+				     int delta)
+{
+	cl->len_bytes += delta;
+	(cl->flows[cl->flow_head]).len_bytes += delta;
+	dwrr_stats_add(cl, enq_bytes, delta);
+	atomic_add(delta, &q->port->sum_len_bytes);
+	if (delta > 0)
+		dwrr_dt_charge(q, cl, delta);
+	else
+		dwrr_dt_release(q, cl, -delta);
+}
+
+void precompute_ratedata(struct dwrr_rate_cfg *r);
+
+void dwrr_port_init(struct dwrr_port *port, s64 now);
+
+/*
+ * Reset the scheduler and its classes. The caller initializes q->cfg and
+ * allocates q->cfg.num_queues classes, dwrr_bitmap_longs(num_queues)
+ * longs for the active bitmaps, num_queues pointers for the heap,
+ * dwrr_num_tenants(&q->cfg) tenants and per-CPU counters for num_queues
+ * classes.
+ * The configuration of the classes and of the tenants is initialized from
+ * global parameters.
+ */
+void dwrr_sched_init(struct dwrr_sched_data *q,
+		     struct dwrr_class *queues,
+		     unsigned long *active,
+		     struct dwrr_class **heap,
+		     struct dwrr_tenant *tenants,
+		     struct dwrr_class_stats __percpu *stats,
+		     struct dwrr_port *port,
+		     s64 now);
+
+/*
+ * Update the values derived from q->cfg and q->rate, so that the data path
+ * does not divide. Called after they have changed.
+ */
+void dwrr_sched_config(struct dwrr_sched_data *q);
+
+/*
+ * Drop all the packets of the scheduler from the port accounting.
+ * Statistics are kept.
+ */
+void dwrr_sched_reset(struct dwrr_sched_data *q, s64 now);
+
+/* Histogram bucket of a sojourn time in ns */
+static inline int dwrr_hist_bucket(u64 ns)
+{
+	int k;
+
+	if (ns < 4)
+		return ns;
+
+	k = fls64(ns) - 1;
+	return min_t(int,
+		     ((k - 1) << 2) + ((ns >> (k - 2)) & 3),
+		     dwrr_hist_buckets - 1);
+}
+
+/* Lower bound in ns of a histogram bucket */
+static inline u64 dwrr_hist_bucket_ns(int i)
+{
+	int k = (i >> 2) + 1;
+
+	if (i < 4)
+		return i;
+
+	return (1ULL << k) + ((u64)(i & 3) << (k - 2));
+}
+
+/* Record the sojourn time of a packet leaving cl */
+static inline void dwrr_sojourn_update(struct dwrr_class *cl, s64 sojourn)
+{
+	cl->sojourn[dwrr_hist_bucket(max_t(s64, sojourn, 0))]++;
+}
+
+/* Map a DSCP value to a queue index */
+static inline int dwrr_classify_dscp(struct dwrr_sched_data *q, u8 dscp)
+{
+	return q->cfg.dscp_queue[dscp & (dwrr_dscp_num - 1)];
+}
+
+/* The number of flows of cl, dwrr_fq_flows once they are attached */
+static inline int dwrr_class_flows(const struct dwrr_class *cl)
+{
+	return cl->flows == &cl->flow ? 1 : dwrr_fq_flows;
+}
+
+/*
+ * Flow sub-queue of cl for a packet of the given flow hash, which is 0
+ * unless fair queueing is enabled for cl
+ */
+static inline int dwrr_flow_classify(struct dwrr_class *cl, u32 hash)
+{
+	if (cl->cfg.fq != dwrr_enable)
+		return 0;
+
+	return (int)(((u64)hash * dwrr_class_flows(cl)) >> 32);
+}
+
+/*
+ * Give cl the dwrr_fq_flows flows for fair queueing. The state of its
+ * single flow moves to flows[0], whose packets the caller moves as well.
+ */
+void dwrr_flows_attach(struct dwrr_class *cl, struct dwrr_flow *flows);
+
+/*
+ * The flow of cl whose head packet goes next, or -1 if cl is empty. Active
+ * flows are served with deficit round robin, dwrr_fq_quantum bytes per
+ * round, inside the share of cl. Calling it again returns the same flow
+ * until a packet of cl has been dequeued.
+ */
+int dwrr_flow_rotate(struct dwrr_class *cl);
+
+static inline int dwrr_flow_next(struct dwrr_class *cl)
+{
+	int i = cl->flow_head;
+
+	if (likely(i < 0 || (cl->flows[i]).deficit > 0))
+		return i;
+
+	return dwrr_flow_rotate(cl);
+}
+
+/* Whether the switch buffer can not hold another packet of len bytes */
+bool dwrr_buffer_overfill(unsigned int len,
+			  struct dwrr_class *cl,
+			  struct dwrr_sched_data *q);
+
+/* Whether ECN marking happens on dequeue rather than on enqueue */
+static inline bool dwrr_dequeue_marking(struct dwrr_sched_data *q)
+{
+	return q->cfg.enable_dequeue_ecn == dwrr_enable ||
+	       q->cfg.ecn_scheme == dwrr_mq_ecn_delay;
+}
+
+/*
+ * Whether the packet at the tail (enqueue) or head (dequeue) of cl needs CE.
+ * sojourn is the sojourn time of the packet in ns on dequeue, or -1 on
+ * enqueue.
+ */
+bool dwrr_ecn_marking(struct dwrr_sched_data *q,
+		      struct dwrr_class *cl,
+		      s64 sojourn);
+
+/* The caller has set CE on the packet that dwrr_ecn_marking() has chosen */
+void dwrr_ecn_marked(struct dwrr_sched_data *q,
+		     struct dwrr_class *cl,
+		     s64 sojourn);
+
+/* Decay round time after the port has been idle. Called before enqueue. */
+void dwrr_idle_update(struct dwrr_sched_data *q, s64 now);
+
+/*
+ * Account for a packet of len bytes which has been appended to flow of cl.
+ * Queues which become active use the scheduling mode of this time until
+ * they are empty again.
+ */
+void dwrr_enqueue_update(struct dwrr_sched_data *q,
+			 struct dwrr_class *cl,
+			 int flow,
+			 unsigned int len,
+			 s64 now);
+
+/*
+ * Choose the queue to transmit according to strict priority, DWRR and the
+ * token bucket. Active strict priority queues go first, the highest level
+ * first, and queues of the same level in index order. In SCFQ mode, the
+ * queue with the smallest finish time goes next. With tenants, round robin
+ * queues go when both their deficit and that of their tenant allow. With
+ * gso_split, a GSO packet larger than the deficit of its queue is segmented
+ * first.
+ * A packet larger than the bucket goes when the bucket is full and leaves
+ * a token debt, so that GSO packets never stall the rate limiter.
+ * On success, return the queue and the wire length of its head packet.
+ * Return NULL if no queue is active, or if we don't have enough tokens,
+ * in which case *result is the (negative) token shortage in ns.
+ */
+struct dwrr_class *dwrr_schedule(struct dwrr_sched_data *q,
+				 s64 now,
+				 unsigned int *len,
+				 s64 *result);
+
+/*
+ * Delay in ns of the next dequeue attempt after dwrr_schedule has returned
+ * a token shortage (result < 0). Waiting for at least the watchdog slack
+ * lets one wakeup release several packets at high packet rates.
+ */
+static inline s64 dwrr_watchdog_delay(struct dwrr_sched_data *q, s64 result)
+{
+	return max_t(s64, -result, q->cfg.watchdog_slack_ns);
+}
+
+/*
+ * The caller has armed a timer, which fires after delay ns, for the packet
+ * that the rate limiter delayed
+ */
+void dwrr_watchdog_armed(struct dwrr_sched_data *q, s64 delay);
+
+/*
+ * Account for the head packet of cl which has been chosen by dwrr_schedule
+ * and removed from flow cl->flow_head, so that dwrr_class_head_len()
+ * returns the next one.
+ */
+void dwrr_dequeue_update(struct dwrr_sched_data *q,
+			 struct dwrr_class *cl,
+			 unsigned int len,
+			 s64 now,
+			 s64 result);
+
+#endif
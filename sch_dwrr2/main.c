@@ -1,407 +1,647 @@
 #include <linux/module.h>
 #include <linux/types.h>
 #include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <net/netlink.h>
 #include <linux/pkt_sched.h>
 #include <net/sch_generic.h>
 #include <net/pkt_sched.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <net/dsfield.h>
 #include <net/inet_ecn.h>
 
-#include "params.h"
+#include "dwrr.h"
+#include "pkt_sched_dwrr.h"
 
-struct dwrr_rate_cfg
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
+/**
+ *	struct dwrr_dev_port - switch port emulated by one or more schedulers
+ *	@port: state shared by the schedulers of the port
+ *	@list: linked list of all the ports
+ *	@key: network device, or the scheduler if it has a port of its own
+ *	@refcnt: number of schedulers attached to the port
+ */
+struct dwrr_dev_port
 {
-	u64	rate_bps;
-	u32	mult;
-	u32	shift;
+	struct dwrr_port	port;
+	struct list_head	list;
+	void			*key;
+	int			refcnt;
 };
 
 /**
- *	struct dwrr_class - a Class of Service (CoS) queue
- *	@qdisc: FIFO queue to store sk_buff
- *  	@alist: active linked list
+ *	struct dwrr_snapshot - immutable configuration of an instance
+ *	@gen: generation, incremented by every new snapshot of the instance
+ *	@rate_bps: shaping rate
+ *	@cfg: per-instance parameters
+ *	@queues: configuration of each queue
+ *	@tenants: configuration of each tenant
+ *	@rcu: frees the snapshot after readers are done with it
  *
- *	@id: queue ID
- *	@deficit: deficit counter of this queue (bytes)
- *	@len_bytes: queue length in bytes
- *  	@start_time: time when this queue is inserted to active list
- *	@last_pkt_time: time when this queue transmits the last packet
- *	@quantum: quantum in bytes of this queue
+ *	sysctl and netlink writers copy the current snapshot, change the copy
+ *	and publish it with RCU under dwrr_lock. The data path checks @gen
+ *	once per enqueue and per dequeue pass, and copies a new snapshot to
+ *	the scheduler, so that a packet sees a single configuration from
+ *	start to end.
+ */
+struct dwrr_snapshot
+{
+	u32			gen;
+	u64			rate_bps;
+	struct dwrr_config	cfg;
+	struct dwrr_queue_cfg	*queues;
+	struct dwrr_tenant_cfg	*tenants;
+	struct rcu_head		rcu;
+};
+
+/*
+ * All the ports, all the instances and the snapshots of the instances,
+ * protected by dwrr_lock
+ */
+static LIST_HEAD(dwrr_ports);
+static LIST_HEAD(dwrr_instances);
+static DEFINE_MUTEX(dwrr_lock);
 
+/*
+ * Hundreds of queues may not fit in a kmalloc() allocation. Memory of the
+ * data path goes to the NUMA node of the CPUs which transmit on the device.
  */
-struct dwrr_class
+static void *dwrr_zalloc(size_t size, int node)
 {
-	struct Qdisc		*qdisc;
-	struct list_head	alist;
+	void *ptr = kzalloc_node(size, GFP_KERNEL | __GFP_NOWARN, node);
 
-	int	id;
-	u32	deficit;
-	u32	len_bytes;
-	s64	start_time;
-	s64	last_pkt_time;
-	u32	quantum;
-};
+	if (!ptr)
+		ptr = vzalloc_node(size, node);
+	return ptr;
+}
 
-/**
- *	struct dwrr_sched_data - DWRR scheduler
- *	@queues: multiple Class of Service (CoS) queues
- *	@rate: shaping rate
- *	@active: linked list to store active queues
- *	@watchdog: watchdog timer for token bucket rate limiter
- *
- *	@tokens: tokens in ns
- *	@sum_len_bytes: the total buffer occupancy (in bytes) of the switch port
- *	@time_ns: time check-point
- *	@round_time: estimation of round time in ns
- *	@last_idle_time: last time when the port is idle
+/*
+ * NUMA node of the TX queue of the scheduler, where qdisc_alloc() has put
+ * the scheduler itself
  */
-struct dwrr_sched_data
-{
-	struct dwrr_class	*queues;
-	struct dwrr_rate_cfg	rate;
-	struct list_head	active;
-	struct qdisc_watchdog	watchdog;
-
-	s64	tokens;
-	u32	sum_len_bytes;
-	s64	time_ns;
-	s64	round_time;
-	s64	last_idle_time;
-};
+static inline int dwrr_node(struct Qdisc *sch)
+{
+	return netdev_queue_numa_node_read(sch->dev_queue);
+}
+
+/* NUMA node of the device, for the state shared by its TX queues */
+static inline int dwrr_dev_node(struct net_device *dev)
+{
+	return dev->dev.parent ? dev_to_node(dev->dev.parent) : NUMA_NO_NODE;
+}
+
+/* A snapshot with room for n queues and nt tenants */
+static struct dwrr_snapshot *dwrr_snapshot_alloc(int n, int nt, int node)
+{
+	struct dwrr_snapshot *s;
+
+	s = dwrr_zalloc(sizeof(*s) + n * sizeof(struct dwrr_queue_cfg) +
+			nt * sizeof(struct dwrr_tenant_cfg), node);
+	if (unlikely(!s))
+		return NULL;
+
+	s->queues = (struct dwrr_queue_cfg *)(s + 1);
+	s->tenants = (struct dwrr_tenant_cfg *)(s->queues + n);
+	return s;
+}
 
-/* Exponential Weighted Moving Average (EWMA) for s64 */
-static inline s64 s64_ewma(s64 smooth, s64 sample, int weight, int shift)
+static inline struct dwrr_snapshot *dwrr_snapshot(struct dwrr_sched_data *q)
 {
-	s64 val = smooth * weight;
-	val += sample * ((1 << shift) - weight);
-	return val >> shift;
+	return rcu_dereference_protected(q->snap, lockdep_is_held(&dwrr_lock));
+}
+
+/* A copy of the current snapshot of q to change, or NULL */
+static struct dwrr_snapshot *dwrr_snapshot_dup(struct dwrr_sched_data *q)
+{
+	struct dwrr_snapshot *old = dwrr_snapshot(q), *s;
+
+	s = dwrr_snapshot_alloc(q->cfg.num_queues, q->num_tenants, q->node);
+	if (unlikely(!s))
+		return NULL;
+
+	s->gen = old->gen + 1;
+	s->rate_bps = old->rate_bps;
+	s->cfg = old->cfg;
+	memcpy(s->queues, old->queues,
+	       q->cfg.num_queues * sizeof(struct dwrr_queue_cfg));
+	memcpy(s->tenants, old->tenants,
+	       q->num_tenants * sizeof(struct dwrr_tenant_cfg));
+	return s;
+}
+
+static void dwrr_snapshot_free(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct dwrr_snapshot, rcu));
+}
+
+/* Replace the snapshot of q with s */
+static void dwrr_snapshot_publish(struct dwrr_sched_data *q,
+				  struct dwrr_snapshot *s)
+{
+	struct dwrr_snapshot *old = dwrr_snapshot(q);
+
+	rcu_assign_pointer(q->snap, s);
+	if (old)
+		call_rcu(&old->rcu, dwrr_snapshot_free);
 }
 
 /*
- * We use this function to account for the true number of bytes sent on wire.
- * 20 = frame check sequence(8B)+Interpacket gap(12B)
- * 4 = Frame check sequence (4B)
- * dwrr_min_pkt_bytes = Minimum Ethernet frame size (64B)
+ * Allocate the flows of the queues which get fair queueing for the first
+ * time in snapshot s, before s is published. Queues keep their flows once
+ * they have them, and the others keep a single FIFO.
  */
-static inline unsigned int skb_size(struct sk_buff *skb)
+static int dwrr_snapshot_flows(struct dwrr_sched_data *q,
+			       struct dwrr_snapshot *s)
 {
-	return max_t(unsigned int, skb->len + 4, dwrr_min_pkt_bytes) + 20;
+	struct Qdisc *sch = q->watchdog.qdisc;
+	struct dwrr_class *cl;
+	struct dwrr_flow *flows;
+	int i, j;
+
+	for (i = 0; i < q->cfg.num_queues; i++)
+	{
+		cl = &(q->queues[i]);
+		if (s->queues[i].fq != dwrr_enable || dwrr_class_flows(cl) > 1)
+			continue;
+
+		flows = dwrr_zalloc(dwrr_fq_flows * sizeof(struct dwrr_flow),
+				    q->node);
+		if (unlikely(!flows))
+			return -ENOMEM;
+		for (j = 0; j < dwrr_fq_flows; j++)
+			__skb_queue_head_init(&flows[j].skbs);
+
+		sch_tree_lock(sch);
+		skb_queue_splice_init(&(cl->flow).skbs, &flows[0].skbs);
+		dwrr_flows_attach(cl, flows);
+		sch_tree_unlock(sch);
+	}
+
+	return 0;
 }
 
-/* Borrow from ptb */
-static inline void precompute_ratedata(struct dwrr_rate_cfg *r)
+/* Copy a new snapshot to the scheduler. Called by the data path. */
+static void dwrr_snapshot_apply(struct dwrr_sched_data *q,
+				struct dwrr_snapshot *s)
 {
-	r->shift = 0;
-	r->mult = 1;
+	int i;
+
+	q->cfg = s->cfg;
+	for (i = 0; i < q->cfg.num_queues; i++)
+		(q->queues[i]).cfg = s->queues[i];
+	for (i = 0; i < q->num_tenants; i++)
+		(q->tenants[i]).cfg = s->tenants[i];
 
-	if (r->rate_bps > 0)
+	if (s->rate_bps != q->rate.rate_bps)
 	{
-		r->shift = 15;
-		r->mult = div64_u64(8LLU * NSEC_PER_SEC * (1 << r->shift),
-				    r->rate_bps);
+		q->rate.rate_bps = s->rate_bps;
+		precompute_ratedata(&q->rate);
 	}
+
+	dwrr_sched_config(q);
+	q->snap_gen = s->gen;
 }
 
-/* Borrow from ptb: length (bytes) to time (nanosecond) */
-static inline u64 l2t_ns(struct dwrr_rate_cfg *r, unsigned int len_bytes)
+/*
+ * Apply the snapshot of q if it has changed since the last packet. The
+ * qdisc runs with BH disabled, which is the RCU read side.
+ */
+static inline void dwrr_snapshot_sync(struct dwrr_sched_data *q)
 {
-	return ((u64)len_bytes * r->mult) >> r->shift;
+	struct dwrr_snapshot *s = rcu_dereference_bh(q->snap);
+
+	if (unlikely(s->gen != q->snap_gen))
+		dwrr_snapshot_apply(q, s);
 }
 
-/* MQ-ECN ECN marking */
-void dwrr_mq_ecn_marking(struct sk_buff *skb,
-		      	 struct dwrr_sched_data *q,
-		      	 struct dwrr_class *cl)
+/* Get the port of the key, or create it for the first scheduler */
+static struct dwrr_port *dwrr_port_get(void *key, int node)
 {
-	u64 ecn_thresh_bytes, estimate_rate_bps;
+	struct dwrr_dev_port *p, *new;
 
-	if (q->round_time > 0)
-		estimate_rate_bps = div_u64((u64)cl->quantum << 33,
-					    q->round_time);
-	else
-		estimate_rate_bps = q->rate.rate_bps;
+	new = kzalloc_node(sizeof(*new), GFP_KERNEL, node);
+
+	mutex_lock(&dwrr_lock);
+	list_for_each_entry(p, &dwrr_ports, list)
+	{
+		if (p->key == key)
+		{
+			p->refcnt++;
+			goto out;
+		}
+	}
 
-	/* rate <= link capacity */
-	estimate_rate_bps = min_t(u64, estimate_rate_bps, q->rate.rate_bps);
-	ecn_thresh_bytes = div_u64(estimate_rate_bps * dwrr_port_thresh_bytes,
-				   q->rate.rate_bps);
+	p = new;
+	new = NULL;
+	if (likely(p))
+	{
+		dwrr_port_init(&p->port, ktime_get_ns());
+		p->key = key;
+		p->refcnt = 1;
+		list_add(&p->list, &dwrr_ports);
+	}
+out:
+	mutex_unlock(&dwrr_lock);
+	kfree(new);
+	return p ? &p->port : NULL;
+}
 
-	if (cl->len_bytes > ecn_thresh_bytes)
-		INET_ECN_set_ce(skb);
+static void dwrr_port_put(struct dwrr_port *port)
+{
+	struct dwrr_dev_port *p = container_of(port, struct dwrr_dev_port, port);
 
-	if (dwrr_enable_debug == dwrr_enable)
-		printk(KERN_INFO "queue %d quantum %u ECN threshold %llu\n",
-	       	       cl->id,
-		       cl->quantum,
-		       ecn_thresh_bytes);
+	mutex_lock(&dwrr_lock);
+	if (--p->refcnt == 0)
+		list_del(&p->list);
+	else
+		p = NULL;
+	mutex_unlock(&dwrr_lock);
+	kfree(p);
 }
 
-/* ECN marking: per-queue, per-port and MQ-ECN */
-void dwrr_ecn_marking(struct sk_buff *skb,
-		      struct dwrr_sched_data *q,
-		      struct dwrr_class *cl)
+/*
+ * Apply a global parameter written through sysctl to all the instances,
+ * each with a new snapshot
+ */
+void dwrr_params_changed(struct dwrr_param *param)
 {
-	switch (dwrr_ecn_scheme)
+	struct dwrr_sched_data *q;
+	struct dwrr_snapshot *s;
+
+	if (param->offset < 0)
+		return;
+
+	mutex_lock(&dwrr_lock);
+	list_for_each_entry(q, &dwrr_instances, list)
 	{
-		/* Per-queue ECN marking */
-		case dwrr_queue_ecn:
+		s = dwrr_snapshot_dup(q);
+		if (unlikely(!s))
 		{
-			if (cl->len_bytes > dwrr_queue_thresh_bytes[cl->id])
-				INET_ECN_set_ce(skb);
-			break;
+			printk(KERN_WARNING "sch_dwrr: no memory to apply %s\n",
+			       param->name);
+			continue;
 		}
-		/* Per-port ECN marking */
-		case dwrr_port_ecn:
+
+		if (param->tenant)
 		{
-			if (q->sum_len_bytes > dwrr_port_thresh_bytes)
-				INET_ECN_set_ce(skb);
-			break;
+			if (param->queue < q->num_tenants)
+				*(int *)((char *)&s->tenants[param->queue] +
+					 param->offset) = *(param->ptr);
 		}
-		/* MQ-ECN */
-		case dwrr_mq_ecn:
+		else if (param->queue >= 0)
 		{
-			dwrr_mq_ecn_marking(skb, q, cl);
-			break;
+			if (param->queue < q->cfg.num_queues)
+				*(int *)((char *)&s->queues[param->queue] +
+					 param->offset) = *(param->ptr);
 		}
-		default:
+		else if (param->offset == dwrr_config_offset(dscp_queue))
 		{
-			break;
+			dwrr_config_dscp_init(&s->cfg);
 		}
+		else
+		{
+			*(int *)((char *)&s->cfg + param->offset) = *(param->ptr);
+		}
+
+		/* netlink may have set the other end of the ramp */
+		if (s->cfg.ecn_ramp_min > s->cfg.ecn_ramp_max)
+		{
+			printk(KERN_WARNING "sch_dwrr: ecn_ramp_min %d above "
+			       "ecn_ramp_max %d, %s not applied\n",
+			       s->cfg.ecn_ramp_min, s->cfg.ecn_ramp_max,
+			       param->name);
+			kvfree(s);
+			continue;
+		}
+
+		if (unlikely(dwrr_snapshot_flows(q, s)))
+		{
+			printk(KERN_WARNING "sch_dwrr: no memory to apply %s\n",
+			       param->name);
+			kvfree(s);
+			continue;
+		}
+		dwrr_snapshot_publish(q, s);
 	}
+	mutex_unlock(&dwrr_lock);
 }
 
-static struct dwrr_class *dwrr_classify(struct sk_buff *skb, struct Qdisc *sch)
+/*
+ * The root scheduler of the device and the children of mq (one per
+ * hardware TX queue) emulate one switch port, and share its buffer and
+ * round time. A scheduler under any other parent (e.g., prio or htb)
+ * emulates a switch port of its own.
+ */
+static void *dwrr_port_key(struct Qdisc *sch)
 {
-	struct dwrr_sched_data *q = qdisc_priv(sch);
-	struct iphdr* iph = ip_hdr(skb);
-	int i, dscp;
+	struct Qdisc *root = qdisc_dev(sch)->qdisc;
 
-	if (unlikely(!(q->queues)))
+	if (sch->parent == TC_H_ROOT)
+		return qdisc_dev(sch);
+
+	if (root &&
+	    TC_H_MAJ(sch->parent) == root->handle &&
+	    (!strcmp(root->ops->id, "mq") || !strcmp(root->ops->id, "mqprio")))
+		return qdisc_dev(sch);
+
+	return sch;
+}
+
+/**
+ *	struct dwrr_skb_cb - private data of a packet in the qdisc
+ *	@enqueue_time: time when the packet is enqueued in ns
+ */
+struct dwrr_skb_cb
+{
+	s64	enqueue_time;
+};
+
+static inline struct dwrr_skb_cb *dwrr_skb_cb(struct sk_buff *skb)
+{
+	qdisc_cb_private_validate(skb, sizeof(struct dwrr_skb_cb));
+	return (struct dwrr_skb_cb *)qdisc_skb_cb(skb)->data;
+}
+
+/*
+ * Wire length of a sk_buff in bytes. qdisc_pkt_len() of a GSO packet
+ * counts the headers of every segment, and each segment is a frame.
+ */
+static inline unsigned int skb_size(struct sk_buff *skb)
+{
+	if (skb_is_gso(skb))
+		return dwrr_gso_wire_bytes(qdisc_pkt_len(skb),
+					   max_t(u16, skb_shinfo(skb)->gso_segs,
+						 1));
+
+	return dwrr_wire_bytes(qdisc_pkt_len(skb));
+}
+
+/* Packets of the flow of cl served now, or NULL if cl is empty */
+static inline struct sk_buff_head *dwrr_class_head_flow(struct dwrr_class *cl)
+{
+	int i = dwrr_flow_next(cl);
+
+	if (i < 0)
 		return NULL;
 
-	/* Return queue[0] by default*/
-	if (unlikely(!iph))
-		return &(q->queues[0]);
+	return &(cl->flows[i]).skbs;
+}
 
-	dscp = iph->tos >> 2;
+unsigned int dwrr_class_head_len(struct dwrr_class *cl)
+{
+	struct sk_buff_head *skbs = dwrr_class_head_flow(cl);
+	struct sk_buff *skb = skbs ? skb_peek(skbs) : NULL;
+
+	if (unlikely(!skb))
+		return 0;
+
+	return skb_size(skb);
+}
 
-	for (i = 0; i < dwrr_max_queues; i++)
+/* The number of packets of cl */
+static unsigned int dwrr_class_qlen(struct dwrr_class *cl)
+{
+	unsigned int qlen = 0;
+	int i;
+
+	for (i = 0; i < dwrr_class_flows(cl); i++)
+		qlen += skb_queue_len(&(cl->flows[i]).skbs);
+
+	return qlen;
+}
+
+/* Free the packets of cl */
+static void dwrr_class_purge(struct dwrr_class *cl)
+{
+	int i;
+
+	for (i = 0; i < dwrr_class_flows(cl); i++)
+		__skb_queue_purge(&(cl->flows[i]).skbs);
+}
+
+unsigned int dwrr_class_head_split(struct dwrr_sched_data *q,
+				   struct dwrr_class *cl)
+{
+	struct Qdisc *sch = q->watchdog.qdisc;
+	struct sk_buff_head *skbs = dwrr_class_head_flow(cl);
+	struct sk_buff *skb = skbs ? skb_peek(skbs) : NULL;
+	struct sk_buff *segs, *nskb;
+	struct sk_buff_head list;
+	unsigned int len = 0, pkt_len = 0;
+	int nb = 0;
+
+	if (!skb || !skb_is_gso(skb))
+		return 0;
+
+	segs = skb_gso_segment(skb, netif_skb_features(skb) &
+				    ~NETIF_F_GSO_MASK);
+	if (IS_ERR_OR_NULL(segs))
+		return 0;
+
+	__skb_queue_head_init(&list);
+	while (segs)
 	{
-		if (dscp == dwrr_queue_dscp[i])
-			return &(q->queues[i]);
+		nskb = segs->next;
+		segs->next = NULL;
+		qdisc_skb_cb(segs)->pkt_len = segs->len;
+		len += skb_size(segs);
+		pkt_len += segs->len;
+		__skb_queue_tail(&list, segs);
+		nb++;
+		segs = nskb;
 	}
 
-	return &(q->queues[0]);
+	__skb_unlink(skb, skbs);
+	skb_queue_splice(&list, skbs);
+	dwrr_class_resize(q, cl, (int)len - (int)skb_size(skb));
+	sch->q.qlen += nb - 1;
+	sch->qstats.backlog += pkt_len - qdisc_pkt_len(skb);
+	qdisc_tree_decrease_qlen(sch, 1 - nb);
+	consume_skb(skb);
+
+	return skb_size(skb_peek(skbs));
 }
 
-/* We don't need this */
-static struct sk_buff *dwrr_peek(struct Qdisc *sch)
+/* ECN marking: per-queue, per-port, MQ-ECN and delay-based MQ-ECN */
+static inline void dwrr_ecn_set_ce(struct sk_buff *skb,
+				   struct dwrr_sched_data *q,
+				   struct dwrr_class *cl,
+				   s64 sojourn)
 {
-	return NULL;
+	if (dwrr_ecn_marking(q, cl, sojourn) && INET_ECN_set_ce(skb))
+		dwrr_ecn_marked(q, cl, sojourn);
 }
 
-/* Choose the packet to schedule according to DWRR algorithm */
-/*static struct sk_buff *dwrr_schedule(struct dwrr_sched_data *q,
-				     struct dwrr_class *cl)
+/*
+ * skb->priority major:minor with major equal to our handle selects queue
+ * minor - 1 (e.g., set by SO_PRIORITY or iptables CLASSIFY). Otherwise
+ * the DSCP value selects the queue.
+ */
+static struct dwrr_class *dwrr_classify(struct sk_buff *skb, struct Qdisc *sch)
 {
-	struct sk_buff *skb = NULL;
-	s64 sample;
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	u32 minor = TC_H_MIN(skb->priority);
+	u8 dscp;
 
-	while (true)
-	{
-		cl = list_first_entry(&q->active,
-				      struct dwrr_class,
-				      alist);
+	if (unlikely(!(q->queues)))
+		return NULL;
 
+	if (TC_H_MAJ(skb->priority) == sch->handle &&
+	    minor > 0 && minor <= q->cfg.num_queues)
+		return &(q->queues[minor - 1]);
 
-		if (cl->qdisc->q.qlen == 0)
+	switch (skb->protocol)
+	{
+		case htons(ETH_P_IP):
 		{
-			sample = cl->last_pkt_time - cl->start_time;
-			q->round_time = s64_ewma(q->round_time,
-						    sample,
-						    dwrr_round_alpha,
-						    dwrr_round_alpha_shift);
-			list_del(&cl->alist);
-			continue;
+			if (unlikely(!pskb_network_may_pull(skb,
+							    sizeof(struct iphdr))))
+				return &(q->queues[0]);
+			dscp = ipv4_get_dsfield(ip_hdr(skb)) >> 2;
+			break;
 		}
-
-		skb = cl->qdisc->ops->peek(cl->qdisc);
-		if (unlikely(!skb))
-			goto out;
-
-		if (skb_size(skb) <= cl->deficit)
+		case htons(ETH_P_IPV6):
 		{
-			return skb;
+			if (unlikely(!pskb_network_may_pull(skb,
+							    sizeof(struct ipv6hdr))))
+				return &(q->queues[0]);
+			dscp = ipv6_get_dsfield(ipv6_hdr(skb)) >> 2;
+			break;
 		}
-		else
+		/* Return queue[0] by default*/
+		default:
 		{
-			sample = cl->last_pkt_time - cl->start_time;
-			q->round_time = s64_ewma(q->round_time,
-						    sample,
-						    dwrr_round_alpha,
-						    dwrr_round_alpha_shift);
-
-			cl->start_time = cl->last_pkt_time;
-			cl->quantum = dwrr_queue_quantum[cl->id];
-
-			if (dwrr_enable_wrr == dwrr_enable)
-				cl->deficit = cl->quantum;
-			else
-				cl->deficit += cl->quantum;
-
-			list_move_tail(&cl->alist, &q->active);
+			return &(q->queues[0]);
 		}
 	}
 
-out:
-	return NULL;
+	return &(q->queues[dwrr_classify_dscp(q, dscp)]);
 }
-*/
 
-/* Decide whether the packet can be transmitted according to Token Bucket */
-static s64 tbf_schedule(unsigned int len, struct dwrr_sched_data *q, s64 now)
+/*
+ * Flow sub-queue of skb in cl. The flow hash is only computed with fair
+ * queueing.
+ */
+static inline int dwrr_classify_flow(struct sk_buff *skb,
+				     struct dwrr_class *cl)
 {
-	s64 pkt_ns, toks;
-
-	toks = now - q->time_ns;
-	toks = min_t(s64, toks, (s64)l2t_ns(&q->rate, dwrr_bucket_bytes));
-	toks += q->tokens;
+	if (cl->cfg.fq != dwrr_enable)
+		return 0;
 
-	pkt_ns = (s64)l2t_ns(&q->rate, len);
-
-	return toks - pkt_ns;
+	return dwrr_flow_classify(cl, skb_get_hash(skb));
 }
 
-static inline void print_round_time(s64 sample, s64 smooth)
+/*
+ * Arm the watchdog for the next dequeue attempt. A pending timer which
+ * fires earlier is kept rather than reprogrammed.
+ */
+static void dwrr_watchdog_schedule(struct Qdisc *sch, s64 now, s64 result)
 {
-	/* Print necessary information in debug mode */
-	if (dwrr_enable_debug == dwrr_enable && dwrr_ecn_scheme == dwrr_mq_ecn)
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct hrtimer *timer = &q->watchdog.timer;
+	/* For hrtimer absolute mode, we use now + t */
+	s64 delay = dwrr_watchdog_delay(q, result);
+	s64 expires = now + delay;
+
+	if (hrtimer_is_queued(timer) &&
+	    ktime_to_ns(hrtimer_get_expires(timer)) <= expires)
 	{
-		printk(KERN_INFO "sample round time %llu\n", sample);
-		printk(KERN_INFO "smooth round time %llu\n", smooth);
+		qdisc_throttled(sch);
+		return;
 	}
+
+	qdisc_watchdog_schedule_ns(&q->watchdog, expires, true);
+	dwrr_watchdog_armed(q, delay);
 }
 
-static struct sk_buff *dwrr_dequeue(struct Qdisc *sch)
+/*
+ * Choose and remove the next packet. It still counts in the qdisc queue
+ * length and backlog until dwrr_dequeue() hands it out. Set *throttled if
+ * the rate limiter has delayed the next packet and a timer is pending.
+ */
+static struct sk_buff *dwrr_dequeue_one(struct Qdisc *sch, s64 now,
+					bool *throttled)
 {
 	struct dwrr_sched_data *q = qdisc_priv(sch);
 	struct dwrr_class *cl = NULL;
 	struct sk_buff *skb = NULL;
-	s64 sample, result;
-	s64 now = ktime_get_ns();
-	s64 bucket_ns = (s64)l2t_ns(&q->rate, dwrr_bucket_bytes);
+	s64 result, sojourn;
 	unsigned int len;
 
-	/* No active queue */
-	if (list_empty(&q->active))
+	cl = dwrr_schedule(q, now, &len, &result);
+	if (!cl)
+	{
+		/* If we don't have enough tokens */
+		if (result < 0)
+		{
+			dwrr_watchdog_schedule(sch, now, result);
+			qdisc_qstats_overlimit(sch);
+			*throttled = true;
+		}
 		return NULL;
+	}
 
-	while (1)
-	{
-		cl = list_first_entry(&q->active, struct dwrr_class, alist);
-		if (unlikely(!cl))
-			return NULL;
+	skb = __skb_dequeue(&(cl->flows[cl->flow_head]).skbs);
+	if (unlikely(!skb))
+		return NULL;
 
-		/* get head packet */
-		skb = cl->qdisc->ops->peek(cl->qdisc);
-		if (unlikely(!skb))
-			return NULL;
+	dwrr_dequeue_update(q, cl, len, now, result);
+	sojourn = now - dwrr_skb_cb(skb)->enqueue_time;
+	dwrr_sojourn_update(cl, sojourn);
 
-		len = skb_size(skb);
-		if (unlikely(len > dwrr_max_pkt_bytes))
-			printk(KERN_INFO "Error: pkt length %u > MTU\n", len);
+	if (dwrr_dequeue_marking(q))
+		dwrr_ecn_set_ce(skb, q, cl, sojourn);
 
-		/* If this packet can be scheduled by DWRR */
-		if (len <= cl->deficit)
-		{
-			result = tbf_schedule(len, q, now);
-			/* If we don't have enough tokens */
-			if (result < 0)
-			{
-				/* For hrtimer absolute mode, we use now + t */
-				qdisc_watchdog_schedule_ns(&q->watchdog,
-							   now - result,
-							   true);
-				qdisc_qstats_overlimit(sch);
-				return NULL;
-			}
-
-			skb = qdisc_dequeue_peeked(cl->qdisc);
-			if (unlikely(!skb))
-				return NULL;
-
-			q->sum_len_bytes -= len;
-			sch->q.qlen--;
-			cl->len_bytes -= len;
-			cl->deficit -= len;
-			cl->last_pkt_time = now + l2t_ns(&q->rate, len);
-
-			if (cl->qdisc->q.qlen == 0)
-			{
-				list_del(&cl->alist);
-				sample = cl->last_pkt_time - cl->start_time;
-				q->round_time = s64_ewma(q->round_time,
-							sample, dwrr_round_alpha, dwrr_round_alpha_shift);
-
-				/* Get start time of idle period */
-				if (q->sum_len_bytes == 0)
-					q->last_idle_time = now;
-
-				print_round_time(sample, q->round_time);
-			}
-
-			/* Bucket */
-			q->time_ns = now;
-			q->tokens = min_t(s64, result, bucket_ns);
-			qdisc_unthrottled(sch);
-			qdisc_bstats_update(sch, skb);
+	return skb;
+}
 
-			if (dwrr_enable_dequeue_ecn == dwrr_enable)
-				dwrr_ecn_marking(skb, q, cl);
+/*
+ * Release as many packets as tokens allow, up to dequeue_batch, in one pass
+ * with one clock read. They are then handed out one per call, so that the
+ * stack sends them to the driver back to back with xmit_more.
+ */
+static struct sk_buff *dwrr_dequeue(struct Qdisc *sch)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	bool throttled = false;
+	s64 now;
+	int i;
 
-			return skb;
-		}
-		/* This packet can not be scheduled by DWRR */
-		else
+	if (skb_queue_empty(&q->ready))
+	{
+		dwrr_snapshot_sync(q);
+		now = ktime_get_ns();
+		for (i = 0; i < q->cfg.dequeue_batch; i++)
 		{
-			sample = cl->last_pkt_time - cl->start_time;
-			q->round_time = s64_ewma(q->round_time,
-						 sample,
-						 dwrr_round_alpha, dwrr_round_alpha_shift);
-			cl->start_time = cl->last_pkt_time;
-			cl->quantum = dwrr_queue_quantum[cl->id];
-			list_move_tail(&cl->alist, &q->active);
-
-			/* WRR */
-			if (dwrr_enable_wrr == dwrr_enable)
-				cl->deficit = cl->quantum;
-			/* DWRR */
-			else
-				cl->deficit += cl->quantum;
-
-			print_round_time(sample, q->round_time);
+			skb = dwrr_dequeue_one(sch, now, &throttled);
+			if (!skb)
+				break;
+			__skb_queue_tail(&q->ready, skb);
 		}
+
+		/* A timer armed by the end of the pass keeps us throttled */
+		if (i > 0 && !throttled)
+			qdisc_unthrottled(sch);
 	}
 
-	return NULL;
-}
+	skb = __skb_dequeue(&q->ready);
+	if (!skb)
+		return NULL;
 
-static bool dwrr_buffer_overfill(unsigned int len,
-				 struct dwrr_class *cl,
-				 struct dwrr_sched_data *q)
-{
-	/* per-port shared buffer */
-	if (dwrr_buffer_mode == dwrr_shared_buffer &&
-	    q->sum_len_bytes + len > dwrr_shared_buffer_bytes)
-		return true;
-	/* per-queue static buffer */
-	else if (dwrr_buffer_mode == dwrr_static_buffer &&
-		 cl->len_bytes + len > dwrr_queue_buffer_bytes[cl->id])
-		return true;
-	else
-		return false;
+	sch->q.qlen--;
+	qdisc_qstats_backlog_dec(sch, skb);
+	qdisc_bstats_update(sch, skb);
+	return skb;
 }
 
 static int dwrr_enqueue(struct sk_buff *skb, struct Qdisc *sch)
@@ -409,67 +649,36 @@ static int dwrr_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 	struct dwrr_class *cl = NULL;
 	unsigned int len = skb_size(skb);
 	struct dwrr_sched_data *q = qdisc_priv(sch);
-	s64 interval, interval_num = 0;
-	int i, ret;
+	s64 now = ktime_get_ns();
+	int flow;
 
-	if (q->sum_len_bytes == 0 &&
-	    dwrr_ecn_scheme == dwrr_mq_ecn &&
-     	    dwrr_idle_interval_ns > 0)
-	{
-		interval = ktime_get_ns() - q->last_idle_time;
-		interval_num = div_s64(interval, dwrr_idle_interval_ns);
-	}
-
-	if (interval_num > 0 && interval_num <= dwrr_max_iteration)
-	{
-		for (i = 0; i < interval_num; i++)
-			q->round_time = s64_ewma(q->round_time,
-						 0,
-						 dwrr_round_alpha, dwrr_round_alpha_shift);
-	}
-	else if (interval_num > dwrr_max_iteration)
-	{
-		q->round_time = 0;
-	}
+	dwrr_snapshot_sync(q);
+	dwrr_idle_update(q, now);
 
 	cl = dwrr_classify(skb,sch);
 	/* No appropriate queue or the switch buffer is overfilled */
 	if (unlikely(!cl) || dwrr_buffer_overfill(len, cl, q))
 	{
 		qdisc_qstats_drop(sch);
-		qdisc_qstats_drop(cl->qdisc);
-		kfree_skb(skb);
-		return NET_XMIT_DROP;
-	}
-
-	ret = qdisc_enqueue(skb, cl->qdisc);
-	if (unlikely(ret != NET_XMIT_SUCCESS))
-	{
-		if (likely(net_xmit_drop_count(ret)))
+		if (likely(cl))
 		{
-			qdisc_qstats_drop(sch);
-			qdisc_qstats_drop(cl->qdisc);
+			dwrr_stats_add(cl, drops, 1);
+			trace_dwrr_drop(q, cl, len);
 		}
-		return ret;
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
 	}
 
-	/* Update queue sizes */
+	dwrr_skb_cb(skb)->enqueue_time = now;
+	flow = dwrr_classify_flow(skb, cl);
+	__skb_queue_tail(&(cl->flows[flow]).skbs, skb);
 	sch->q.qlen++;
-	q->sum_len_bytes += len;
-	cl->len_bytes += len;
+	qdisc_qstats_backlog_inc(sch, skb);
+	dwrr_enqueue_update(q, cl, flow, len, now);
 
-	/* If the queue is empty, insert it to the linked list */
-	if (cl->qdisc->q.qlen == 1)
-	{
-		cl->start_time = ktime_get_ns();
-		cl->quantum = dwrr_queue_quantum[cl->id];
-		cl->deficit = cl->quantum;
-		list_add_tail(&(cl->alist), &(q->active));
-	}
-
-	if (dwrr_enable_dequeue_ecn == dwrr_disable)
-		dwrr_ecn_marking(skb, q, cl);
-	return ret;
+	if (!dwrr_dequeue_marking(q))
+		dwrr_ecn_set_ce(skb, q, cl, -1);
+	return NET_XMIT_SUCCESS;
 }
 
 /* We don't need this */
@@ -478,130 +687,769 @@ static unsigned int dwrr_drop(struct Qdisc *sch)
 	return 0;
 }
 
-/* We don't need this */
-static int dwrr_dump(struct Qdisc *sch, struct sk_buff *skb)
+static void dwrr_reset(struct Qdisc *sch)
 {
-	return 0;
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	int i;
+
+	__skb_queue_purge(&q->ready);
+	if (likely(q->queues && q->port))
+	{
+		for (i = 0; i < q->cfg.num_queues; i++)
+			dwrr_class_purge(&(q->queues[i]));
+
+		dwrr_sched_reset(q, ktime_get_ns());
+	}
+	sch->q.qlen = 0;
+	sch->qstats.backlog = 0;
+	qdisc_watchdog_cancel(&q->watchdog);
 }
 
 /* Release Qdisc resources */
 static void dwrr_destroy(struct Qdisc *sch)
 {
 	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct dwrr_snapshot *s;
 	int i;
 
+	qdisc_watchdog_cancel(&q->watchdog);
+
+	mutex_lock(&dwrr_lock);
+	list_del_init(&q->list);
+	s = dwrr_snapshot(q);
+	if (s)
+		call_rcu(&s->rcu, dwrr_snapshot_free);
+	RCU_INIT_POINTER(q->snap, NULL);
+	mutex_unlock(&dwrr_lock);
+
+	__skb_queue_purge(&q->ready);
 	if (likely(q->queues))
 	{
-		for (i = 0; i < dwrr_max_queues && (q->queues[i]).qdisc; i++)
-			qdisc_destroy((q->queues[i]).qdisc);
+		if (likely(q->port))
+			dwrr_sched_reset(q, ktime_get_ns());
 
-		kfree(q->queues);
+		for (i = 0; i < q->cfg.num_queues; i++)
+		{
+			dwrr_class_purge(&(q->queues[i]));
+			if (dwrr_class_flows(&(q->queues[i])) > 1)
+				kvfree((q->queues[i]).flows);
+		}
+
+		kvfree(q->queues);
 	}
-	qdisc_watchdog_cancel(&q->watchdog);
+	free_percpu(q->stats);
+	kfree(q->active);
+	kvfree(q->heap);
+	kvfree(q->tenants);
+	if (likely(q->port))
+		dwrr_port_put(q->port);
 }
 
-static const struct nla_policy dwrr_policy[TCA_TBF_MAX + 1] = {
-	[TCA_TBF_PARMS] = { .len = sizeof(struct tc_tbf_qopt) },
-	[TCA_TBF_RTAB]	= { .type = NLA_BINARY, .len = TC_RTAB_SIZE },
-	[TCA_TBF_PTAB]	= { .type = NLA_BINARY, .len = TC_RTAB_SIZE },
+static const struct nla_policy dwrr_policy[TCA_DWRR_MAX + 1] = {
+	[TCA_DWRR_RATE]			= { .type = NLA_U32 },
+	[TCA_DWRR_BUCKET]		= { .type = NLA_U32 },
+	[TCA_DWRR_BUFFER_MODE]		= { .type = NLA_U32 },
+	[TCA_DWRR_SHARED_BUFFER]	= { .type = NLA_U32 },
+	[TCA_DWRR_PORT_THRESH]		= { .type = NLA_U32 },
+	[TCA_DWRR_ECN_SCHEME]		= { .type = NLA_U32 },
+	[TCA_DWRR_ROUND_ALPHA]		= { .type = NLA_U32 },
+	[TCA_DWRR_IDLE_INTERVAL]	= { .type = NLA_U32 },
+	[TCA_DWRR_ENABLE_WRR]		= { .type = NLA_U32 },
+	[TCA_DWRR_ENABLE_DEQUEUE_ECN]	= { .type = NLA_U32 },
+	[TCA_DWRR_QUEUE_THRESH]		= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_QUEUE_QUANTUM]	= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_QUEUE_BUFFER]		= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_DSCP_MAP]	= { .len = sizeof(u16) * TC_DWRR_DSCP_NUM },
+	[TCA_DWRR_RESET_HIST]	= { .type = NLA_FLAG },
+	[TCA_DWRR_TARGET_DELAY]	= { .type = NLA_U32 },
+	[TCA_DWRR_QUEUES]	= { .type = NLA_U32 },
+	[TCA_DWRR_QUEUE_PRIO]		= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_SCHED_MODE]		= { .type = NLA_U32 },
+	[TCA_DWRR_DEQUEUE_BATCH]	= { .type = NLA_U32 },
+	[TCA_DWRR_WATCHDOG_SLACK]	= { .type = NLA_U32 },
+	[TCA_DWRR_RATE64]		= { .type = NLA_U64 },
+	[TCA_DWRR_GSO_SPLIT]		= { .type = NLA_U32 },
+	[TCA_DWRR_QUEUE_GUARANTEE]	= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_QUEUE_ALPHA]		= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_QUEUE_FQ]		= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_TENANT_QUEUES]	= { .type = NLA_U32 },
+	[TCA_DWRR_TENANT_QUANTUM]	= { .type = NLA_BINARY,
+		.len = sizeof(u32) * TC_DWRR_MAX_QUEUES },
+	[TCA_DWRR_ECN_PROFILE]		= { .type = NLA_U32 },
+	[TCA_DWRR_ECN_RAMP_MIN]		= { .type = NLA_U32 },
+	[TCA_DWRR_ECN_RAMP_MAX]		= { .type = NLA_U32 },
+	[TCA_DWRR_ECN_RAMP_PROB]	= { .type = NLA_U32 },
 };
 
-/* We only leverage TC netlink interface to configure rate */
+/* Global parameter: a u32 in struct dwrr_config */
+#define dwrr_attr_global	1
+/* Per-queue parameter: a u32 per queue in struct dwrr_queue_cfg */
+#define dwrr_attr_queue		2
+/* Per-tenant parameter: a u32 per tenant in struct dwrr_tenant_cfg */
+#define dwrr_attr_tenant	3
+
+/**
+ *	struct dwrr_attr - netlink attribute of a per-instance parameter
+ *	@type: dwrr_attr_global, dwrr_attr_queue or dwrr_attr_tenant
+ *	@offset: offset of the field in struct dwrr_config (global), in
+ *	struct dwrr_queue_cfg (per-queue) or in struct dwrr_tenant_cfg
+ *	(per-tenant)
+ *	@min: minimum value
+ *	@max: maximum value
+ */
+struct dwrr_attr
+{
+	int	type;
+	int	offset;
+	u32	min;
+	u32	max;
+};
+
+static const struct dwrr_attr dwrr_attrs[TCA_DWRR_MAX + 1] = {
+	[TCA_DWRR_BUCKET] = { dwrr_attr_global,
+			      dwrr_config_offset(bucket_bytes), 0, INT_MAX },
+	[TCA_DWRR_BUFFER_MODE] = { dwrr_attr_global,
+				   dwrr_config_offset(buffer_mode),
+				   dwrr_shared_buffer, dwrr_dt_buffer },
+	[TCA_DWRR_SHARED_BUFFER] = { dwrr_attr_global,
+				     dwrr_config_offset(shared_buffer_bytes),
+				     0, INT_MAX },
+	[TCA_DWRR_PORT_THRESH] = { dwrr_attr_global,
+				   dwrr_config_offset(port_thresh_bytes),
+				   0, INT_MAX },
+	[TCA_DWRR_ECN_SCHEME] = { dwrr_attr_global,
+				  dwrr_config_offset(ecn_scheme),
+				  dwrr_disable_ecn, dwrr_mq_ecn_delay },
+	[TCA_DWRR_ROUND_ALPHA] = { dwrr_attr_global,
+				   dwrr_config_offset(round_alpha),
+				   0, 1 << dwrr_round_alpha_shift },
+	[TCA_DWRR_IDLE_INTERVAL] = { dwrr_attr_global,
+				     dwrr_config_offset(idle_interval_ns),
+				     0, INT_MAX },
+	[TCA_DWRR_ENABLE_WRR] = { dwrr_attr_global,
+				  dwrr_config_offset(enable_wrr),
+				  dwrr_disable, dwrr_enable },
+	[TCA_DWRR_ENABLE_DEQUEUE_ECN] = { dwrr_attr_global,
+					  dwrr_config_offset(enable_dequeue_ecn),
+					  dwrr_disable, dwrr_enable },
+	[TCA_DWRR_TARGET_DELAY] = { dwrr_attr_global,
+				    dwrr_config_offset(target_delay_ns),
+				    0, INT_MAX },
+	[TCA_DWRR_SCHED_MODE] = { dwrr_attr_global,
+				  dwrr_config_offset(sched_mode),
+				  dwrr_mode_rr, dwrr_mode_scfq },
+	[TCA_DWRR_DEQUEUE_BATCH] = { dwrr_attr_global,
+				     dwrr_config_offset(dequeue_batch),
+				     1, dwrr_max_dequeue_batch },
+	[TCA_DWRR_WATCHDOG_SLACK] = { dwrr_attr_global,
+				      dwrr_config_offset(watchdog_slack_ns),
+				      0, NSEC_PER_SEC },
+	[TCA_DWRR_GSO_SPLIT] = { dwrr_attr_global,
+				 dwrr_config_offset(gso_split),
+				 dwrr_disable, dwrr_enable },
+	[TCA_DWRR_ECN_PROFILE] = { dwrr_attr_global,
+				   dwrr_config_offset(ecn_profile),
+				   dwrr_ecn_step, dwrr_ecn_ramp_step },
+	[TCA_DWRR_ECN_RAMP_MIN] = { dwrr_attr_global,
+				    dwrr_config_offset(ecn_ramp_min),
+				    0, dwrr_max_ecn_ramp },
+	[TCA_DWRR_ECN_RAMP_MAX] = { dwrr_attr_global,
+				    dwrr_config_offset(ecn_ramp_max),
+				    0, dwrr_max_ecn_ramp },
+	[TCA_DWRR_ECN_RAMP_PROB] = { dwrr_attr_global,
+				     dwrr_config_offset(ecn_ramp_prob),
+				     0, 100 },
+	[TCA_DWRR_QUEUE_THRESH] = { dwrr_attr_queue,
+				    dwrr_queue_cfg_offset(thresh_bytes),
+				    0, INT_MAX },
+	[TCA_DWRR_QUEUE_QUANTUM] = { dwrr_attr_queue,
+				     dwrr_queue_cfg_offset(quantum),
+				     dwrr_max_pkt_bytes,
+				     dwrr_max_quantum_bytes },
+	[TCA_DWRR_QUEUE_BUFFER] = { dwrr_attr_queue,
+				    dwrr_queue_cfg_offset(buffer_bytes),
+				    0, INT_MAX },
+	[TCA_DWRR_QUEUE_PRIO] = { dwrr_attr_queue,
+				  dwrr_queue_cfg_offset(prio),
+				  0, dwrr_max_prio },
+	[TCA_DWRR_QUEUE_GUARANTEE] = { dwrr_attr_queue,
+				       dwrr_queue_cfg_offset(guarantee_bytes),
+				       0, dwrr_max_buffer_bytes },
+	[TCA_DWRR_QUEUE_ALPHA] = { dwrr_attr_queue,
+				   dwrr_queue_cfg_offset(alpha),
+				   0, dwrr_max_dt_alpha },
+	[TCA_DWRR_QUEUE_FQ] = { dwrr_attr_queue,
+				dwrr_queue_cfg_offset(fq),
+				dwrr_disable, dwrr_enable },
+	[TCA_DWRR_TENANT_QUANTUM] = { dwrr_attr_tenant,
+				      dwrr_tenant_cfg_offset(quantum),
+				      0, dwrr_max_tenant_quantum_bytes },
+};
+
+/*
+ * Update cfg with global netlink attributes, and validate per-queue and
+ * per-tenant attributes, which dwrr_change_queues() applies afterwards.
+ */
+static int dwrr_parse_config(struct dwrr_config *cfg, struct nlattr **tb)
+{
+	const struct dwrr_attr *attr;
+	u32 *val;
+	u16 *map;
+	int i, j, n;
+
+	if (tb[TCA_DWRR_QUEUES] &&
+	    nla_get_u32(tb[TCA_DWRR_QUEUES]) != cfg->num_queues)
+		return -EINVAL;
+
+	if (tb[TCA_DWRR_TENANT_QUEUES] &&
+	    nla_get_u32(tb[TCA_DWRR_TENANT_QUEUES]) != cfg->tenant_queues)
+		return -EINVAL;
+
+	for (i = 0; i <= TCA_DWRR_MAX; i++)
+	{
+		attr = &dwrr_attrs[i];
+		if (!tb[i] || !attr->type)
+			continue;
+
+		val = nla_data(tb[i]);
+		if (attr->type == dwrr_attr_global)
+		{
+			if (val[0] < attr->min || val[0] > attr->max)
+				return -EINVAL;
+			*(int *)((char *)cfg + attr->offset) = val[0];
+			continue;
+		}
+
+		/* Per-queue (per-tenant) values start from queue (tenant) 0 */
+		n = nla_len(tb[i]) / sizeof(u32);
+		if (nla_len(tb[i]) % sizeof(u32) ||
+		    n > (attr->type == dwrr_attr_tenant ?
+			 dwrr_num_tenants(cfg) : cfg->num_queues))
+			return -EINVAL;
+
+		for (j = 0; j < n; j++)
+		{
+			if (val[j] != TC_DWRR_KEEP_U32 &&
+			    (val[j] < attr->min || val[j] > attr->max))
+				return -EINVAL;
+		}
+	}
+
+	/* The ramp of the ECN marking profile can not end before it starts */
+	if (cfg->ecn_ramp_min > cfg->ecn_ramp_max)
+	{
+		printk(KERN_WARNING "sch_dwrr: ecn_ramp_min %d above "
+		       "ecn_ramp_max %d\n",
+		       cfg->ecn_ramp_min, cfg->ecn_ramp_max);
+		return -EINVAL;
+	}
+
+	if (tb[TCA_DWRR_DSCP_MAP])
+	{
+		map = nla_data(tb[TCA_DWRR_DSCP_MAP]);
+		for (i = 0; i < dwrr_dscp_num; i++)
+		{
+			if (map[i] == TC_DWRR_KEEP_U16)
+				continue;
+			if (map[i] >= cfg->num_queues)
+				return -EINVAL;
+			cfg->dscp_queue[i] = map[i];
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Apply per-queue and per-tenant attributes validated by
+ * dwrr_parse_config() to a new snapshot
+ */
+static void dwrr_change_queues(struct dwrr_snapshot *s, struct nlattr **tb)
+{
+	const struct dwrr_attr *attr;
+	char *cfg;
+	u32 *val;
+	int i, j, n;
+
+	for (i = 0; i <= TCA_DWRR_MAX; i++)
+	{
+		attr = &dwrr_attrs[i];
+		if (!tb[i] || (attr->type != dwrr_attr_queue &&
+			       attr->type != dwrr_attr_tenant))
+			continue;
+
+		val = nla_data(tb[i]);
+		n = nla_len(tb[i]) / sizeof(u32);
+		for (j = 0; j < n; j++)
+		{
+			if (val[j] == TC_DWRR_KEEP_U32)
+				continue;
+			if (attr->type == dwrr_attr_tenant)
+				cfg = (char *)&s->tenants[j];
+			else
+				cfg = (char *)&s->queues[j];
+			*(int *)(cfg + attr->offset) = val[j];
+		}
+	}
+}
+
+/*
+ * Configure rate and the per-instance parameters. The rate is mandatory
+ * when the qdisc is created. The number of queues and the number of queues
+ * of each tenant can not be changed.
+ */
 static int dwrr_change(struct Qdisc *sch, struct nlattr *opt)
 {
-	int err;
+	int i, err;
 	struct dwrr_sched_data *q = qdisc_priv(sch);
-	struct nlattr *tb[TCA_TBF_PTAB + 1];
-	struct tc_tbf_qopt *qopt;
-	__u32 rate;
+	struct nlattr *tb[TCA_DWRR_MAX + 1];
+	struct dwrr_snapshot *s;
+	u64 rate_bps = 0;
+
+	if (!opt)
+		return -EINVAL;
 
-	err = nla_parse_nested(tb, TCA_TBF_PTAB, opt, dwrr_policy);
+	err = nla_parse_nested(tb, TCA_DWRR_MAX, opt, dwrr_policy);
 	if(err < 0)
 		return err;
 
-	err = -EINVAL;
-	if (!tb[TCA_TBF_PARMS])
-		goto done;
+	/* convert from bytes/s to b/s. RATE64 carries rates of 34Gbps and up */
+	if (tb[TCA_DWRR_RATE64])
+		rate_bps = nla_get_u64(tb[TCA_DWRR_RATE64]) << 3;
+	else if (tb[TCA_DWRR_RATE])
+		rate_bps = (u64)nla_get_u32(tb[TCA_DWRR_RATE]) << 3;
+
+	/* Serialize with sysctl writes to the snapshot */
+	mutex_lock(&dwrr_lock);
+	s = dwrr_snapshot_dup(q);
+	if (unlikely(!s))
+	{
+		mutex_unlock(&dwrr_lock);
+		return -ENOMEM;
+	}
+
+	if (rate_bps > 0)
+		s->rate_bps = rate_bps;
+	err = dwrr_parse_config(&s->cfg, tb);
+	if (likely(!err) && s->rate_bps == 0)
+		err = -EINVAL;
+	if (likely(!err))
+	{
+		dwrr_change_queues(s, tb);
+		err = dwrr_snapshot_flows(q, s);
+	}
+	if (likely(!err))
+	{
+		dwrr_snapshot_publish(q, s);
+		rate_bps = s->rate_bps;
+	}
+	else
+	{
+		kvfree(s);
+	}
+	mutex_unlock(&dwrr_lock);
+
+	if (unlikely(err))
+		return err;
+
+	/* Histograms belong to the data path */
+	if (tb[TCA_DWRR_RESET_HIST])
+	{
+		sch_tree_lock(sch);
+		for (i = 0; i < q->cfg.num_queues; i++)
+			memset((q->queues[i]).sojourn, 0,
+			       sizeof((q->queues[i]).sojourn));
+		sch_tree_unlock(sch);
+	}
+
+	printk(KERN_INFO "sch_dwrr: rate %llu Mbps\n", rate_bps/1000000);
+	return 0;
+}
+
+/*
+ * Per-queue parameters are dumped with each class, and per-tenant ones as
+ * arrays with the qdisc
+ */
+static int dwrr_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	const struct dwrr_attr *attr;
+	struct dwrr_snapshot *s;
+	struct nlattr *nest;
+	u32 *val;
+	int i, j;
+
+	/* Too large for the stack with 1024 tenants */
+	val = kmalloc_array(max_t(int, q->num_tenants, 1), sizeof(u32),
+			    GFP_KERNEL);
+	if (unlikely(!val))
+		return -1;
+
+	mutex_lock(&dwrr_lock);
+	s = dwrr_snapshot(q);
 
-	qopt = nla_data(tb[TCA_TBF_PARMS]);
-	rate = qopt->rate.rate;
-	/* convert from bytes/s to b/s */
-	q->rate.rate_bps = (u64)rate << 3;
-	precompute_ratedata(&q->rate);
-	err = 0;
-	printk(KERN_INFO "sch_dwrr: rate %llu Mbps\n",q->rate.rate_bps/1000000);
+	nest = nla_nest_start(skb, TCA_OPTIONS);
+	if (!nest)
+		goto nla_put_failure;
 
- done:
+	/* convert from b/s to bytes/s */
+	if (nla_put_u32(skb, TCA_DWRR_RATE,
+			min_t(u64, s->rate_bps >> 3, ~0U)) ||
+	    nla_put_u32(skb, TCA_DWRR_QUEUES, s->cfg.num_queues) ||
+	    nla_put_u32(skb, TCA_DWRR_TENANT_QUEUES, s->cfg.tenant_queues))
+		goto nla_put_failure;
+
+	if ((s->rate_bps >> 3) > ~0U &&
+	    nla_put_u64(skb, TCA_DWRR_RATE64, s->rate_bps >> 3))
+		goto nla_put_failure;
+
+	for (i = 0; i <= TCA_DWRR_MAX; i++)
+	{
+		attr = &dwrr_attrs[i];
+		if (attr->type == dwrr_attr_global &&
+		    nla_put_u32(skb, i,
+				*(int *)((char *)&s->cfg + attr->offset)))
+			goto nla_put_failure;
+
+		if (attr->type != dwrr_attr_tenant || q->num_tenants == 0)
+			continue;
+
+		for (j = 0; j < q->num_tenants; j++)
+			val[j] = *(int *)((char *)&s->tenants[j] +
+					  attr->offset);
+		if (nla_put(skb, i, q->num_tenants * sizeof(u32), val))
+			goto nla_put_failure;
+	}
+
+	if (nla_put(skb, TCA_DWRR_DSCP_MAP, sizeof(s->cfg.dscp_queue),
+		    s->cfg.dscp_queue))
+		goto nla_put_failure;
+
+	mutex_unlock(&dwrr_lock);
+	kfree(val);
+	return nla_nest_end(skb, nest);
+
+nla_put_failure:
+	mutex_unlock(&dwrr_lock);
+	kfree(val);
+	nla_nest_cancel(skb, nest);
+	return -1;
+}
+
+static int dwrr_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct tc_dwrr_xstats *st;
+	int err;
+
+	/* Too large for the stack with the histograms of a class */
+	st = kzalloc(sizeof(*st), GFP_ATOMIC);
+	if (unlikely(!st))
+		return -1;
+
+	st->type = TCA_DWRR_XSTATS_QDISC;
+	st->qdisc_stats.round_time = atomic64_read(&q->port->round_time);
+	st->qdisc_stats.tokens = q->tokens;
+	st->qdisc_stats.overlimits = sch->qstats.overlimits;
+	st->qdisc_stats.backlog = atomic_read(&q->port->sum_len_bytes);
+	st->qdisc_stats.strict_rate = q->sp_rate_bps;
+	st->qdisc_stats.shared_backlog =
+		atomic_read(&q->port->shared_len_bytes);
+
+	err = gnet_stats_copy_app(d, st, sizeof(*st));
+	kfree(st);
+	return err;
+}
+
+/*
+ * Queue i is class major:(i + 1). Classes are fixed, so they only support
+ * dump and statistics.
+ */
+static struct Qdisc *dwrr_leaf(struct Qdisc *sch, unsigned long arg)
+{
+	return NULL;
+}
+
+static unsigned long dwrr_get(struct Qdisc *sch, u32 classid)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	unsigned long minor = TC_H_MIN(classid);
+
+	if (minor == 0 || minor > q->cfg.num_queues)
+		return 0;
+	return minor;
+}
+
+static void dwrr_put(struct Qdisc *sch, unsigned long arg)
+{
+}
+
+static void dwrr_walk(struct Qdisc *sch, struct qdisc_walker *arg)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	int i;
+
+	if (arg->stop)
+		return;
+
+	for (i = 0; i < q->cfg.num_queues; i++)
+	{
+		if (arg->count < arg->skip)
+		{
+			arg->count++;
+			continue;
+		}
+		if (arg->fn(sch, i + 1, arg) < 0)
+		{
+			arg->stop = 1;
+			break;
+		}
+		arg->count++;
+	}
+}
+
+static int dwrr_dump_class(struct Qdisc *sch, unsigned long arg,
+			   struct sk_buff *skb, struct tcmsg *tcm)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct dwrr_queue_cfg cfg;
+	const struct dwrr_attr *attr;
+	struct nlattr *nest;
+	int i;
+
+	mutex_lock(&dwrr_lock);
+	cfg = dwrr_snapshot(q)->queues[arg - 1];
+	mutex_unlock(&dwrr_lock);
+
+	tcm->tcm_parent = TC_H_ROOT;
+	tcm->tcm_handle = sch->handle | arg;
+	tcm->tcm_info = 0;
+
+	nest = nla_nest_start(skb, TCA_OPTIONS);
+	if (!nest)
+		goto nla_put_failure;
+
+	for (i = 0; i <= TCA_DWRR_MAX; i++)
+	{
+		attr = &dwrr_attrs[i];
+		if (attr->type == dwrr_attr_queue &&
+		    nla_put_u32(skb, i, *(int *)((char *)&cfg + attr->offset)))
+			goto nla_put_failure;
+	}
+
+	return nla_nest_end(skb, nest);
+
+nla_put_failure:
+	nla_nest_cancel(skb, nest);
+	return -1;
+}
+
+static int dwrr_dump_class_stats(struct Qdisc *sch, unsigned long arg,
+				 struct gnet_dump *d)
+{
+	struct dwrr_sched_data *q = qdisc_priv(sch);
+	struct dwrr_class *cl = &(q->queues[arg - 1]);
+	struct gnet_stats_basic_packed bstats;
+	struct gnet_stats_queue qstats;
+	struct dwrr_class_stats sum;
+	struct tc_dwrr_class_xstats *cst;
+	struct tc_dwrr_xstats *st;
+	int err;
+
+	dwrr_class_stats_read(cl, &sum);
+
+	memset(&bstats, 0, sizeof(bstats));
+	bstats.bytes = sum.deq_bytes;
+	bstats.packets = sum.deq_pkts;
+
+	memset(&qstats, 0, sizeof(qstats));
+	qstats.backlog = cl->len_bytes;
+	qstats.drops = sum.drops;
+	qstats.overlimits = sum.overlimits;
+
+	if (gnet_stats_copy_basic(d, NULL, &bstats) < 0 ||
+	    gnet_stats_copy_queue(d, NULL, &qstats, dwrr_class_qlen(cl)) < 0)
+		return -1;
+
+	st = kzalloc(sizeof(*st), GFP_ATOMIC);
+	if (unlikely(!st))
+		return -1;
+
+	st->type = TCA_DWRR_XSTATS_CLASS;
+	cst = &st->class_stats;
+	cst->enq_bytes = sum.enq_bytes;
+	cst->enq_packets = sum.enq_pkts;
+	cst->deq_bytes = sum.deq_bytes;
+	cst->deq_packets = sum.deq_pkts;
+	cst->drops = sum.drops;
+	cst->marks = sum.marks;
+	cst->len_bytes = cl->len_bytes;
+	cst->deficit = cl->deficit;
+	cst->quantum = cl->quantum;
+	memcpy(cst->sojourn, cl->sojourn, sizeof(cst->sojourn));
+	cst->overlimits = sum.overlimits;
+	cst->watchdogs = sum.watchdogs;
+
+	err = gnet_stats_copy_app(d, st, sizeof(*st));
+	kfree(st);
 	return err;
 }
 
 /* Initialize Qdisc */
 static int dwrr_init(struct Qdisc *sch, struct nlattr *opt)
 {
-	int i;
+	int i, n, err;
 	struct dwrr_sched_data *q = qdisc_priv(sch);
-	struct Qdisc *child;
+	struct nlattr *tb[TCA_DWRR_MAX + 1];
+	struct dwrr_snapshot *s;
+	struct dwrr_port *port;
+	void *key;
 
-	if(sch->parent != TC_H_ROOT)
-		return -EOPNOTSUPP;
+	qdisc_watchdog_init(&q->watchdog, sch);
+	__skb_queue_head_init(&q->ready);
+	INIT_LIST_HEAD(&q->list);
 
-	q->queues = kcalloc(dwrr_max_queues,
-			    sizeof(struct dwrr_class),
-			    GFP_KERNEL);
-	if (unlikely(!(q->queues)))
+	if (!opt)
+		return -EINVAL;
+
+	err = nla_parse_nested(tb, TCA_DWRR_MAX, opt, dwrr_policy);
+	if (err < 0)
+		return err;
+
+	/* The number of queues and tenants is fixed from now on */
+	dwrr_config_init(&q->cfg);
+	if (tb[TCA_DWRR_QUEUES])
+	{
+		n = nla_get_u32(tb[TCA_DWRR_QUEUES]);
+		if (n < 1 || n > dwrr_max_queues)
+			return -EINVAL;
+		q->cfg.num_queues = n;
+		dwrr_config_dscp_init(&q->cfg);
+	}
+	if (tb[TCA_DWRR_TENANT_QUEUES])
+	{
+		n = nla_get_u32(tb[TCA_DWRR_TENANT_QUEUES]);
+		if (n > dwrr_max_queues)
+			return -EINVAL;
+		q->cfg.tenant_queues = n;
+	}
+	n = q->cfg.num_queues;
+
+	key = dwrr_port_key(sch);
+	port = dwrr_port_get(key, key == sch ? dwrr_node(sch) :
+			     dwrr_dev_node(qdisc_dev(sch)));
+	if (unlikely(!port))
 		return -ENOMEM;
 
-	q->tokens = 0;
-	q->time_ns = ktime_get_ns();
-	q->last_idle_time = ktime_get_ns();
-	q->sum_len_bytes = 0;
-	q->round_time = 0;
-	qdisc_watchdog_init(&q->watchdog, sch);
-	INIT_LIST_HEAD(&(q->active));
+	q->node = dwrr_node(sch);
+	q->queues = dwrr_zalloc(n * sizeof(struct dwrr_class), q->node);
+	q->active = kzalloc_node(dwrr_bitmap_longs(n) * sizeof(unsigned long),
+				 GFP_KERNEL, q->node);
+	q->heap = dwrr_zalloc(n * sizeof(struct dwrr_class *), q->node);
+	q->tenants = dwrr_zalloc(max_t(int, dwrr_num_tenants(&q->cfg), 1) *
+				 sizeof(struct dwrr_tenant), q->node);
+	q->stats = __alloc_percpu(n * sizeof(struct dwrr_class_stats),
+				  __alignof__(struct dwrr_class_stats));
+	if (unlikely(!(q->queues) || !(q->active) || !(q->heap) ||
+		     !(q->tenants) || !(q->stats)))
+	{
+		kvfree(q->queues);
+		kfree(q->active);
+		kvfree(q->heap);
+		kvfree(q->tenants);
+		free_percpu(q->stats);
+		q->queues = NULL;
+		q->active = NULL;
+		q->heap = NULL;
+		q->tenants = NULL;
+		q->stats = NULL;
+		dwrr_port_put(port);
+		return -ENOMEM;
+	}
 
-	for (i = 0;i < dwrr_max_queues; i++)
+	for (i = 0; i < n; i++)
+		__skb_queue_head_init(&(q->queues[i]).flow.skbs);
+
+	dwrr_sched_init(q, q->queues, q->active, q->heap, q->tenants, q->stats,
+			port, ktime_get_ns());
+
+	/* The first snapshot is what dwrr_sched_init() has configured */
+	s = dwrr_snapshot_alloc(n, q->num_tenants, q->node);
+	if (unlikely(!s))
 	{
-		/* bfifo is in bytes */
-		child = fifo_create_dflt(sch,
-					&bfifo_qdisc_ops, dwrr_max_buffer_bytes);
-		if (likely(child))
-			(q->queues[i]).qdisc = child;
-		else
-			goto err;
-
-		/* Initialize variables for dwrr_class */
-		INIT_LIST_HEAD(&((q->queues[i]).alist));
-		(q->queues[i]).id = i;
-		(q->queues[i]).deficit = 0;
-		(q->queues[i]).len_bytes = 0;
-		(q->queues[i]).start_time = ktime_get_ns();
-		(q->queues[i]).last_pkt_time = ktime_get_ns();
-		(q->queues[i]).quantum = 0;
+		dwrr_destroy(sch);
+		return -ENOMEM;
+	}
+	s->gen = q->snap_gen;
+	s->cfg = q->cfg;
+	for (i = 0; i < n; i++)
+		s->queues[i] = (q->queues[i]).cfg;
+	for (i = 0; i < q->num_tenants; i++)
+		s->tenants[i] = (q->tenants[i]).cfg;
+	RCU_INIT_POINTER(q->snap, s);
+	if (unlikely(dwrr_snapshot_flows(q, s)))
+	{
+		dwrr_destroy(sch);
+		return -ENOMEM;
 	}
-	return dwrr_change(sch,opt);
-err:
-	dwrr_destroy(sch);
-	return -ENOMEM;
+
+	err = dwrr_change(sch,opt);
+	if (unlikely(err))
+	{
+		dwrr_destroy(sch);
+		return err;
+	}
+
+	mutex_lock(&dwrr_lock);
+	list_add(&q->list, &dwrr_instances);
+	mutex_unlock(&dwrr_lock);
+	return 0;
 }
 
+static const struct Qdisc_class_ops dwrr_class_ops = {
+	.leaf		=	dwrr_leaf,
+	.get		=	dwrr_get,
+	.put		=	dwrr_put,
+	.walk		=	dwrr_walk,
+	.dump		=	dwrr_dump_class,
+	.dump_stats	=	dwrr_dump_class_stats,
+};
+
 static struct Qdisc_ops dwrr_ops __read_mostly = {
 	.next		=	NULL,
-	.cl_ops		=	NULL,
-	.id		=	"tbf",
+	.cl_ops		=	&dwrr_class_ops,
+	.id		=	"dwrr",
 	.priv_size	=	sizeof(struct dwrr_sched_data),
 	.init		=	dwrr_init,
+	.reset		=	dwrr_reset,
 	.destroy	=	dwrr_destroy,
 	.enqueue	=	dwrr_enqueue,
 	.dequeue	=	dwrr_dequeue,
-	.peek		=	dwrr_peek,
+	/*
+	 * Choose the packet with DWRR and the token bucket as dequeue does,
+	 * and keep it for the following qdisc_dequeue_peeked() of the parent
+	 */
+	.peek		=	qdisc_peek_dequeued,
 	.drop		=	dwrr_drop,
 	.change		=	dwrr_change,
 	.dump		=	dwrr_dump,
+	.dump_stats	=	dwrr_dump_stats,
 	.owner		=	THIS_MODULE,
 };
 
 static int __init dwrr_module_init(void)
 {
+	BUILD_BUG_ON(TC_DWRR_MAX_QUEUES != dwrr_max_queues);
+	BUILD_BUG_ON(TC_DWRR_DSCP_NUM != dwrr_dscp_num);
+	BUILD_BUG_ON(TC_DWRR_HIST_BUCKETS != dwrr_hist_buckets);
+
 	if (unlikely(!dwrr_params_init()))
 		return -1;
 
@@ -613,6 +1461,8 @@ static void __exit dwrr_module_exit(void)
 {
 	dwrr_params_exit();
 	unregister_qdisc(&dwrr_ops);
+	/* Wait for snapshots freed by call_rcu() */
+	rcu_barrier();
 	printk(KERN_INFO "sch_dwrr: stop working\n");
 }
 
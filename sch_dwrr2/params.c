@@ -1,19 +1,25 @@
 #include "params.h"
+
+#ifdef __KERNEL__
 #include <linux/sysctl.h>
 #include <linux/string.h>
+#else
+#include <string.h>
+#endif
 
 
-/* Enable debug mode or not. By default, we disable debug mode. */
-int dwrr_enable_debug = dwrr_disable;
 /*
- * Buffer management mode: shared (0) or static (1).
+ * Buffer management mode: shared (0), static (1) or dynamic threshold (2).
  * By default, we enable shread buffer.
  */
 int dwrr_buffer_mode = dwrr_shared_buffer;
 /* Per port shared buffer (bytes) */
 int dwrr_shared_buffer_bytes = dwrr_max_buffer_bytes;
-/* Bucket size in bytes. By default, we use 2.5KB for 1G network. */
-int dwrr_bucket_bytes = 2500;
+/*
+ * Bucket size in bytes. By default (0), it holds 20us of the shaping rate
+ * (2.5KB for 1G network, 250KB for 100G network) and at least one packet.
+ */
+int dwrr_bucket_bytes = 0;
 /*
  * Per port ECN marking threshold (bytes).
  * By default, we use 32KB for 1G network.
@@ -29,48 +35,166 @@ int dwrr_idle_interval_ns = 12000;
 int dwrr_enable_wrr = dwrr_disable;
 /* By default, we perform enqueue ECN marking. */
 int dwrr_enable_dequeue_ecn = dwrr_disable;
+/*
+ * Per port sojourn time target of delay-based MQ-ECN (ns).
+ * By default, we use 256us (32KB for 1G network).
+ */
+int dwrr_target_delay_ns = 256000;
+/* The number of queues of new instances */
+int dwrr_num_queues = dwrr_default_queues;
+/* By default, we perform round robin scheduling */
+int dwrr_sched_mode = dwrr_mode_rr;
+/* By default, we release one packet per dequeue */
+int dwrr_dequeue_batch = 1;
+/*
+ * Minimum delay of the rate limiter watchdog (ns). By default, we wake up
+ * as soon as we have enough tokens.
+ */
+int dwrr_watchdog_slack_ns = 0;
+/* By default, GSO packets are scheduled as a whole */
+int dwrr_gso_split = dwrr_disable;
+/* No tenants by default: all the queues share the DWRR band */
+int dwrr_tenant_queues = 0;
+/* By default, we mark every packet above the threshold */
+int dwrr_ecn_profile = dwrr_ecn_step;
+/* By default, the ramp runs from half of the threshold to the threshold */
+int dwrr_ecn_ramp_min = 50;
+int dwrr_ecn_ramp_max = 100;
+/* By default, ramp plus step marks 1/4 of the packets at the threshold */
+int dwrr_ecn_ramp_prob = 25;
 
+/* Sizes in bytes and times in ns, as netlink takes them */
+int dwrr_uint_min = 0;
+int dwrr_uint_max = INT_MAX;
 int dwrr_enable_min = dwrr_disable;
 int dwrr_enable_max = dwrr_enable;
 int dwrr_buffer_mode_min = dwrr_shared_buffer;
-int dwrr_buffer_mode_max = dwrr_static_buffer;
+int dwrr_buffer_mode_max = dwrr_dt_buffer;
 int dwrr_ecn_scheme_min = dwrr_disable_ecn;
-int dwrr_ecn_scheme_max = dwrr_mq_ecn;
+int dwrr_ecn_scheme_max = dwrr_mq_ecn_delay;
 int dwrr_round_alpha_min = 0;
 int dwrr_round_alpha_max = 1 << dwrr_round_alpha_shift;
 int dwrr_dscp_min = 0;
-int dwrr_dscp_max = (1 << 6) - 1;
+int dwrr_dscp_max = dwrr_dscp_num - 1;
 int dwrr_quantum_min = dwrr_max_pkt_bytes;
-int dwrr_quantum_max = 200 << 10;
+int dwrr_quantum_max = dwrr_max_quantum_bytes;
+int dwrr_num_queues_min = 1;
+int dwrr_num_queues_max = dwrr_max_queues;
+int dwrr_tenant_queues_min = 0;
+int dwrr_tenant_queues_max = dwrr_max_queues;
+int dwrr_tenant_quantum_min = 0;
+int dwrr_tenant_quantum_max = dwrr_max_tenant_quantum_bytes;
+int dwrr_prio_min = 0;
+int dwrr_prio_max = dwrr_max_prio;
+int dwrr_sched_mode_min = dwrr_mode_rr;
+int dwrr_sched_mode_max = dwrr_mode_scfq;
+int dwrr_dequeue_batch_min = 1;
+int dwrr_dequeue_batch_max = dwrr_max_dequeue_batch;
+int dwrr_watchdog_slack_min = 0;
+int dwrr_watchdog_slack_max = NSEC_PER_SEC;
+int dwrr_guarantee_min = 0;
+int dwrr_guarantee_max = dwrr_max_buffer_bytes;
+int dwrr_alpha_min = 0;
+int dwrr_alpha_max = dwrr_max_dt_alpha;
+int dwrr_ecn_profile_min = dwrr_ecn_step;
+int dwrr_ecn_profile_max = dwrr_ecn_ramp_step;
+int dwrr_ecn_ramp_end_min = 0;
+int dwrr_ecn_ramp_end_max = dwrr_max_ecn_ramp;
+int dwrr_ecn_ramp_prob_min = 0;
+int dwrr_ecn_ramp_prob_max = 100;
 
 /* Per queue ECN marking threshold (bytes) */
-int dwrr_queue_thresh_bytes[dwrr_max_queues];
+int dwrr_queue_thresh_bytes[dwrr_sysctl_queues];
 /* DSCP value for different queues*/
-int dwrr_queue_dscp[dwrr_max_queues];
+int dwrr_queue_dscp[dwrr_sysctl_queues];
 /* Quantum for different queues*/
-int dwrr_queue_quantum[dwrr_max_queues];
+int dwrr_queue_quantum[dwrr_sysctl_queues];
 /* Per queue minimum guarantee buffer (bytes) */
-int dwrr_queue_buffer_bytes[dwrr_max_queues];
+int dwrr_queue_buffer_bytes[dwrr_sysctl_queues];
+/* Strict priority level of different queues */
+int dwrr_queue_prio[dwrr_sysctl_queues];
+/* Per queue guaranteed buffer of DT (bytes) */
+int dwrr_queue_guarantee_bytes[dwrr_sysctl_queues];
+/* Per queue DT alpha (1/1024) */
+int dwrr_queue_alpha[dwrr_sysctl_queues];
+/* Per-flow fair queueing inside different queues or not */
+int dwrr_queue_fq[dwrr_sysctl_queues];
+/* Quantum of different tenants, or 0 for the sum of their queues */
+int dwrr_tenant_quantum[dwrr_sysctl_queues];
+
+/* Queue index of every DSCP value */
+u16 dwrr_dscp_queue[dwrr_dscp_num];
 
 /*
  * All parameters that can be configured through sysctl.
- * We have dwrr_global_params + 4 * dwrr_max_queues parameters in total.
+ * We have dwrr_global_params + 9 * dwrr_sysctl_queues parameters in total.
  */
 struct dwrr_param dwrr_params[dwrr_total_params + 1] =
 {
 	/* Global parameters */
-	{"enable_debug",	&dwrr_enable_debug},
-	{"buffer_mode",		&dwrr_buffer_mode},
-	{"shared_buffer",	&dwrr_shared_buffer_bytes},
-	{"bucket", 		&dwrr_bucket_bytes},
-	{"port_thresh", 	&dwrr_port_thresh_bytes},
-	{"ecn_scheme", 		&dwrr_ecn_scheme},
-	{"round_alpha", 	&dwrr_round_alpha},
-	{"idle_interval_ns",	&dwrr_idle_interval_ns},
-	{"enable_wrr",		&dwrr_enable_wrr},
-	{"enable_dequeue_ecn",	&dwrr_enable_dequeue_ecn},
+	{"buffer_mode",		&dwrr_buffer_mode,
+	 dwrr_config_offset(buffer_mode),		-1,	false,
+	 &dwrr_buffer_mode_min,		&dwrr_buffer_mode_max},
+	{"shared_buffer",	&dwrr_shared_buffer_bytes,
+	 dwrr_config_offset(shared_buffer_bytes),	-1,	false,
+	 &dwrr_uint_min,		&dwrr_uint_max},
+	{"bucket", 		&dwrr_bucket_bytes,
+	 dwrr_config_offset(bucket_bytes),		-1,	false,
+	 &dwrr_uint_min,		&dwrr_uint_max},
+	{"port_thresh", 	&dwrr_port_thresh_bytes,
+	 dwrr_config_offset(port_thresh_bytes),		-1,	false,
+	 &dwrr_uint_min,		&dwrr_uint_max},
+	{"ecn_scheme", 		&dwrr_ecn_scheme,
+	 dwrr_config_offset(ecn_scheme),		-1,	false,
+	 &dwrr_ecn_scheme_min,		&dwrr_ecn_scheme_max},
+	{"round_alpha", 	&dwrr_round_alpha,
+	 dwrr_config_offset(round_alpha),		-1,	false,
+	 &dwrr_round_alpha_min,		&dwrr_round_alpha_max},
+	{"idle_interval_ns",	&dwrr_idle_interval_ns,
+	 dwrr_config_offset(idle_interval_ns),		-1,	false,
+	 &dwrr_uint_min,		&dwrr_uint_max},
+	{"enable_wrr",		&dwrr_enable_wrr,
+	 dwrr_config_offset(enable_wrr),		-1,	false,
+	 &dwrr_enable_min,		&dwrr_enable_max},
+	{"enable_dequeue_ecn",	&dwrr_enable_dequeue_ecn,
+	 dwrr_config_offset(enable_dequeue_ecn),	-1,	false,
+	 &dwrr_enable_min,		&dwrr_enable_max},
+	{"target_delay_ns",	&dwrr_target_delay_ns,
+	 dwrr_config_offset(target_delay_ns),		-1,	false,
+	 &dwrr_uint_min,		&dwrr_uint_max},
+	/* Only for new instances */
+	{"num_queues",		&dwrr_num_queues,		-1,	-1,	false,
+	 &dwrr_num_queues_min,		&dwrr_num_queues_max},
+	{"sched_mode",		&dwrr_sched_mode,
+	 dwrr_config_offset(sched_mode),		-1,	false,
+	 &dwrr_sched_mode_min,		&dwrr_sched_mode_max},
+	{"dequeue_batch",	&dwrr_dequeue_batch,
+	 dwrr_config_offset(dequeue_batch),		-1,	false,
+	 &dwrr_dequeue_batch_min,	&dwrr_dequeue_batch_max},
+	{"watchdog_slack_ns",	&dwrr_watchdog_slack_ns,
+	 dwrr_config_offset(watchdog_slack_ns),		-1,	false,
+	 &dwrr_watchdog_slack_min,	&dwrr_watchdog_slack_max},
+	{"gso_split",		&dwrr_gso_split,
+	 dwrr_config_offset(gso_split),			-1,	false,
+	 &dwrr_enable_min,		&dwrr_enable_max},
+	/* Only for new instances */
+	{"tenant_queues",	&dwrr_tenant_queues,		-1,	-1,	false,
+	 &dwrr_tenant_queues_min,	&dwrr_tenant_queues_max},
+	{"ecn_profile",		&dwrr_ecn_profile,
+	 dwrr_config_offset(ecn_profile),		-1,	false,
+	 &dwrr_ecn_profile_min,		&dwrr_ecn_profile_max},
+	{"ecn_ramp_min",	&dwrr_ecn_ramp_min,
+	 dwrr_config_offset(ecn_ramp_min),		-1,	false,
+	 &dwrr_ecn_ramp_end_min,	&dwrr_ecn_ramp_end_max},
+	{"ecn_ramp_max",	&dwrr_ecn_ramp_max,
+	 dwrr_config_offset(ecn_ramp_max),		-1,	false,
+	 &dwrr_ecn_ramp_end_min,	&dwrr_ecn_ramp_end_max},
+	{"ecn_ramp_prob",	&dwrr_ecn_ramp_prob,
+	 dwrr_config_offset(ecn_ramp_prob),		-1,	false,
+	 &dwrr_ecn_ramp_prob_min,	&dwrr_ecn_ramp_prob_max},
 };
 
+#ifdef __KERNEL__
 struct ctl_table dwrr_params_table[dwrr_total_params + 1];
 
 struct ctl_path dwrr_params_path[] =
@@ -80,43 +204,243 @@ struct ctl_path dwrr_params_path[] =
 };
 
 struct ctl_table_header *dwrr_sysctl = NULL;
+#endif
+
+/*
+ * If several queues have the same DSCP value, the queue with the smallest
+ * index gets the traffic. Unknown DSCP values go to queue 0.
+ */
+void dwrr_dscp_table_update(void)
+{
+	u16 table[dwrr_dscp_num];
+	int i;
+
+	memset(table, 0, sizeof(table));
+	for (i = dwrr_sysctl_queues - 1; i >= 0; i--)
+		table[dwrr_queue_dscp[i] & (dwrr_dscp_num - 1)] = i;
+
+	memcpy(dwrr_dscp_queue, table, sizeof(table));
+}
+
+void dwrr_config_init(struct dwrr_config *cfg)
+{
+	cfg->buffer_mode = dwrr_buffer_mode;
+	cfg->shared_buffer_bytes = dwrr_shared_buffer_bytes;
+	cfg->bucket_bytes = dwrr_bucket_bytes;
+	cfg->port_thresh_bytes = dwrr_port_thresh_bytes;
+	cfg->ecn_scheme = dwrr_ecn_scheme;
+	cfg->round_alpha = dwrr_round_alpha;
+	cfg->idle_interval_ns = dwrr_idle_interval_ns;
+	cfg->enable_wrr = dwrr_enable_wrr;
+	cfg->enable_dequeue_ecn = dwrr_enable_dequeue_ecn;
+	cfg->target_delay_ns = dwrr_target_delay_ns;
+	cfg->num_queues = dwrr_num_queues;
+	cfg->sched_mode = dwrr_sched_mode;
+	cfg->dequeue_batch = dwrr_dequeue_batch;
+	cfg->watchdog_slack_ns = dwrr_watchdog_slack_ns;
+	cfg->gso_split = dwrr_gso_split;
+	cfg->tenant_queues = dwrr_tenant_queues;
+	cfg->ecn_profile = dwrr_ecn_profile;
+	cfg->ecn_ramp_min = dwrr_ecn_ramp_min;
+	cfg->ecn_ramp_max = dwrr_ecn_ramp_max;
+	cfg->ecn_ramp_prob = dwrr_ecn_ramp_prob;
+	dwrr_config_dscp_init(cfg);
+}
+
+void dwrr_config_dscp_init(struct dwrr_config *cfg)
+{
+	int i;
+
+	for (i = 0; i < dwrr_dscp_num; i++)
+	{
+		if (dwrr_dscp_queue[i] < cfg->num_queues)
+			cfg->dscp_queue[i] = dwrr_dscp_queue[i];
+		else
+			cfg->dscp_queue[i] = 0;
+	}
+}
+
+void dwrr_queue_cfg_init(struct dwrr_queue_cfg *cfg, int i)
+{
+	if (i < dwrr_sysctl_queues)
+	{
+		cfg->thresh_bytes = dwrr_queue_thresh_bytes[i];
+		cfg->quantum = dwrr_queue_quantum[i];
+		cfg->buffer_bytes = dwrr_queue_buffer_bytes[i];
+		cfg->prio = dwrr_queue_prio[i];
+		cfg->guarantee_bytes = dwrr_queue_guarantee_bytes[i];
+		cfg->alpha = dwrr_queue_alpha[i];
+		cfg->fq = dwrr_queue_fq[i];
+	}
+	else
+	{
+		cfg->thresh_bytes = dwrr_port_thresh_bytes;
+		cfg->quantum = dwrr_max_pkt_bytes;
+		cfg->buffer_bytes = dwrr_max_buffer_bytes;
+		cfg->prio = 0;
+		cfg->guarantee_bytes = 2 * dwrr_max_pkt_bytes;
+		cfg->alpha = 1 << dwrr_dt_alpha_shift;
+		cfg->fq = dwrr_disable;
+	}
+}
+
+void dwrr_tenant_cfg_init(struct dwrr_tenant_cfg *cfg, int i)
+{
+	if (i < dwrr_sysctl_queues)
+		cfg->quantum = dwrr_tenant_quantum[i];
+	else
+		cfg->quantum = 0;
+}
+
+#ifdef __KERNEL__
+/*
+ * Validate and store the value, then apply it to all the instances.
+ * Per-queue DSCP also rebuilds the DSCP table.
+ */
+static int dwrr_proc_param(struct ctl_table *table,
+			   int write,
+			   void __user *buffer,
+			   size_t *lenp,
+			   loff_t *ppos)
+{
+	struct dwrr_param *param = &dwrr_params[table - dwrr_params_table];
+	int old = *(param->ptr);
+	int ret;
+
+	if (table->extra1)
+		ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	else
+		ret = proc_dointvec(table, write, buffer, lenp, ppos);
+
+	/* The ramp of the ECN marking profile can not end before it starts */
+	if (write && ret == 0 && dwrr_ecn_ramp_min > dwrr_ecn_ramp_max)
+	{
+		printk(KERN_WARNING "sch_dwrr: ecn_ramp_min %d above "
+		       "ecn_ramp_max %d\n",
+		       dwrr_ecn_ramp_min, dwrr_ecn_ramp_max);
+		*(param->ptr) = old;
+		ret = -EINVAL;
+	}
+
+	if (write && ret == 0)
+	{
+		if (param->queue < 0 &&
+		    param->offset == dwrr_config_offset(dscp_queue))
+			dwrr_dscp_table_update();
+		dwrr_params_changed(param);
+	}
+
+	return ret;
+}
+#endif
 
 bool dwrr_params_init(void)
 {
 	int i, index;
-	memset(dwrr_params_table, 0, sizeof(dwrr_params_table));
 
-	for (i = 0; i < dwrr_max_queues; i++)
+	for (i = 0; i < dwrr_sysctl_queues; i++)
 	{
 		/* Per queue ECN marking threshold*/
 		index = dwrr_global_params + i;
 		snprintf(dwrr_params[index].name, 63, "queue_thresh_%d", i);
 		dwrr_params[index].ptr = &dwrr_queue_thresh_bytes[i];
+		dwrr_params[index].min = &dwrr_uint_min;
+		dwrr_params[index].max = &dwrr_uint_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(thresh_bytes);
+		dwrr_params[index].queue = i;
 		dwrr_queue_thresh_bytes[i] = dwrr_port_thresh_bytes;
 
 		/* Per-queue DSCP */
-		index = dwrr_global_params + i + dwrr_max_queues;
+		index = dwrr_global_params + i + dwrr_sysctl_queues;
 		snprintf(dwrr_params[index].name, 63, "queue_dscp_%d", i);
 		dwrr_params[index].ptr = &dwrr_queue_dscp[i];
+		dwrr_params[index].min = &dwrr_dscp_min;
+		dwrr_params[index].max = &dwrr_dscp_max;
+		dwrr_params[index].offset = dwrr_config_offset(dscp_queue);
+		dwrr_params[index].queue = -1;
 		dwrr_queue_dscp[i] = i;
 
 		/* Per-queue Quantum */
-		index = dwrr_global_params + i + 2 * dwrr_max_queues;
+		index = dwrr_global_params + i + 2 * dwrr_sysctl_queues;
 		snprintf(dwrr_params[index].name, 63, "queue_quantum_%d", i);
 		dwrr_params[index].ptr = &dwrr_queue_quantum[i];
+		dwrr_params[index].min = &dwrr_quantum_min;
+		dwrr_params[index].max = &dwrr_quantum_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(quantum);
+		dwrr_params[index].queue = i;
 		dwrr_queue_quantum[i] = dwrr_max_pkt_bytes;
 
 		/* Per-queue buffer size */
-		index = dwrr_global_params + i + 3 * dwrr_max_queues;
+		index = dwrr_global_params + i + 3 * dwrr_sysctl_queues;
 		snprintf(dwrr_params[index].name, 63, "queue_buffer_%d", i);
 		dwrr_params[index].ptr = &dwrr_queue_buffer_bytes[i];
+		dwrr_params[index].min = &dwrr_uint_min;
+		dwrr_params[index].max = &dwrr_uint_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(buffer_bytes);
+		dwrr_params[index].queue = i;
 		dwrr_queue_buffer_bytes[i] = dwrr_max_buffer_bytes;
+
+		/* Per-queue strict priority level */
+		index = dwrr_global_params + i + 4 * dwrr_sysctl_queues;
+		snprintf(dwrr_params[index].name, 63, "queue_prio_%d", i);
+		dwrr_params[index].ptr = &dwrr_queue_prio[i];
+		dwrr_params[index].min = &dwrr_prio_min;
+		dwrr_params[index].max = &dwrr_prio_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(prio);
+		dwrr_params[index].queue = i;
+		dwrr_queue_prio[i] = 0;
+
+		/* Per-queue DT guaranteed buffer. Two packets by default. */
+		index = dwrr_global_params + i + 5 * dwrr_sysctl_queues;
+		snprintf(dwrr_params[index].name, 63, "queue_guarantee_%d", i);
+		dwrr_params[index].ptr = &dwrr_queue_guarantee_bytes[i];
+		dwrr_params[index].min = &dwrr_guarantee_min;
+		dwrr_params[index].max = &dwrr_guarantee_max;
+		dwrr_params[index].offset =
+			dwrr_queue_cfg_offset(guarantee_bytes);
+		dwrr_params[index].queue = i;
+		dwrr_queue_guarantee_bytes[i] = 2 * dwrr_max_pkt_bytes;
+
+		/* Per-queue DT alpha. It is 1 by default. */
+		index = dwrr_global_params + i + 6 * dwrr_sysctl_queues;
+		snprintf(dwrr_params[index].name, 63, "queue_alpha_%d", i);
+		dwrr_params[index].ptr = &dwrr_queue_alpha[i];
+		dwrr_params[index].min = &dwrr_alpha_min;
+		dwrr_params[index].max = &dwrr_alpha_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(alpha);
+		dwrr_params[index].queue = i;
+		dwrr_queue_alpha[i] = 1 << dwrr_dt_alpha_shift;
+
+		/* Per-queue flow fair queueing. It is disabled by default. */
+		index = dwrr_global_params + i + 7 * dwrr_sysctl_queues;
+		snprintf(dwrr_params[index].name, 63, "queue_fq_%d", i);
+		dwrr_params[index].ptr = &dwrr_queue_fq[i];
+		dwrr_params[index].min = &dwrr_enable_min;
+		dwrr_params[index].max = &dwrr_enable_max;
+		dwrr_params[index].offset = dwrr_queue_cfg_offset(fq);
+		dwrr_params[index].queue = i;
+		dwrr_queue_fq[i] = dwrr_disable;
+
+		/* Per-tenant quantum. The sum of its queues by default. */
+		index = dwrr_global_params + i + 8 * dwrr_sysctl_queues;
+		snprintf(dwrr_params[index].name, 63, "tenant_quantum_%d", i);
+		dwrr_params[index].ptr = &dwrr_tenant_quantum[i];
+		dwrr_params[index].min = &dwrr_tenant_quantum_min;
+		dwrr_params[index].max = &dwrr_tenant_quantum_max;
+		dwrr_params[index].offset = dwrr_tenant_cfg_offset(quantum);
+		dwrr_params[index].queue = i;
+		dwrr_params[index].tenant = true;
+		dwrr_tenant_quantum[i] = 0;
 	}
 
 	/* End of the parameters */
-	dwrr_params[dwrr_global_params + 4 * dwrr_max_queues].ptr = NULL;
+	dwrr_params[dwrr_total_params].ptr = NULL;
+	dwrr_dscp_table_update();
+
+#ifdef __KERNEL__
+	memset(dwrr_params_table, 0, sizeof(dwrr_params_table));
 
-	for (i = 0; i < dwrr_global_params + 4 * dwrr_max_queues; i++)
+	for (i = 0; i < dwrr_total_params; i++)
 	{
 		struct ctl_table *entry = &dwrr_params_table[i];
 
@@ -124,55 +448,10 @@ bool dwrr_params_init(void)
 		entry->procname = dwrr_params[i].name;
 		entry->data = dwrr_params[i].ptr;
 		entry->mode = 0644;
-
-		/* enable_debug, enable_wrr and enable_dequeue_ecn */
-		if (i == 0 || i == 8 || i == 9)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_enable_min;
-			entry->extra2 = &dwrr_enable_max;
-		}
-		/* buffer_mode */
-		else if (i == 1)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_buffer_mode_min;
-			entry->extra2 = &dwrr_buffer_mode_max;
-		}
-		/* ecn_scheme */
-		else if (i == 5)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_ecn_scheme_min;
-			entry->extra2 = &dwrr_ecn_scheme_max;
-		}
-		/* round_alpha */
-		else if (i == 6)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_round_alpha_min;
-			entry->extra2 = &dwrr_round_alpha_max;
-		}
-		/* Per-queue DSCP */
-		else if (i >= dwrr_global_params + dwrr_max_queues &&
-			 i < dwrr_global_params + 2 * dwrr_max_queues)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_dscp_min;
-			entry->extra2 = &dwrr_dscp_max;
-		}
-		/* Per-queue quantum */
-		else if (i >= dwrr_global_params + 2 * dwrr_max_queues &&
-			 i < dwrr_global_params + 3 * dwrr_max_queues)
-		{
-			entry->proc_handler = &proc_dointvec_minmax;
-			entry->extra1 = &dwrr_quantum_min;
-			entry->extra2 = &dwrr_quantum_max;
-		}
-		else
-		{
-			entry->proc_handler = &proc_dointvec;
-		}
+		entry->proc_handler = &dwrr_proc_param;
+		/* Bounds of the parameter, checked by proc_dointvec_minmax() */
+		entry->extra1 = dwrr_params[i].min;
+		entry->extra2 = dwrr_params[i].max;
 		entry->maxlen=sizeof(int);
 	}
 
@@ -183,11 +462,15 @@ bool dwrr_params_init(void)
 		return true;
 	else
 		return false;
-
+#else
+	return true;
+#endif
 }
 
 void dwrr_params_exit()
 {
+#ifdef __KERNEL__
 	if (likely(dwrr_sysctl))
 		unregister_sysctl_table(dwrr_sysctl);
+#endif
 }
@@ -1,10 +1,14 @@
 #ifndef __PARAMS_H__
 #define __PARAMS_H__
 
-#include <linux/types.h>
+#include "compat.h"
 
-/* Our module has at most 8 queues */
-#define dwrr_max_queues 8
+/* Each instance has at most 1024 queues */
+#define dwrr_max_queues 1024
+/* The number of queues of an instance by default */
+#define dwrr_default_queues 8
+/* The number of queues with per-queue sysctl parameters */
+#define dwrr_sysctl_queues 8
 /*
  * 1538 = MTU (1500B) + Ethernet header(14B) + Frame check sequence (4B) +
  * Frame check sequence(8B) + Interpacket gap(12B)
@@ -15,12 +19,27 @@
  * (header (14B) + user data + FCS (4B)) are padded to 64 bytes.
  */
 #define dwrr_min_pkt_bytes 64
+/* DSCP is 6 bits */
+#define dwrr_dscp_num (1 << 6)
+/* Maximum quantum in bytes */
+#define dwrr_max_quantum_bytes (200 << 10)
+/* Maximum quantum of a tenant in bytes */
+#define dwrr_max_tenant_quantum_bytes (8 * dwrr_max_quantum_bytes)
 /* Maximum (per queue/per port shared) buffer size (2MB) */
 #define dwrr_max_buffer_bytes 2000000
 /* Per port shared buffer management policy */
 #define	dwrr_shared_buffer 0
 /* Per port static buffer management policy */
 #define	dwrr_static_buffer 1
+/*
+ * Dynamic threshold (DT): a guaranteed minimum per queue plus a shared
+ * pool, of which a queue may hold up to alpha times the free space
+ */
+#define	dwrr_dt_buffer 2
+/* Fixed point of DT alpha (1/1024) */
+#define dwrr_dt_alpha_shift 10
+/* Maximum DT alpha (64) */
+#define dwrr_max_dt_alpha (64 << dwrr_dt_alpha_shift)
 
 /* Disable ECN marking */
 #define	dwrr_disable_ecn 0
@@ -30,27 +49,63 @@
 #define dwrr_port_ecn 2
 /* MQ-ECN */
 #define dwrr_mq_ecn 3
+/* MQ-ECN with sojourn time (marking on dequeue) */
+#define dwrr_mq_ecn_delay 4
+
+/* Marking profile over the threshold of the ECN scheme: step */
+#define dwrr_ecn_step 0
+/* Probability rising from 0 to 1 between the ends of the ramp */
+#define dwrr_ecn_ramp 1
+/* Probability rising to ecn_ramp_prob, and marking above the ramp */
+#define dwrr_ecn_ramp_step 2
+/* Maximum end of the ramp (percent of the threshold) */
+#define dwrr_max_ecn_ramp 400
+/* Ends of the ramp and probability are kept in 1/2^16 in the data path */
+#define dwrr_ecn_ramp_shift 16
+
+/* Flow sub-queues of each queue (a power of 2) */
+#define dwrr_fq_flows 64
+/* Quantum of a flow sub-queue in bytes */
+#define dwrr_fq_quantum dwrr_max_pkt_bytes
+
+/* Highest strict priority level. Level 0 is the DWRR band. */
+#define dwrr_max_prio 7
+/* Window of the rate estimation of strict priority queues (100us) */
+#define dwrr_sp_window_ns 100000
+
+/* Maximum number of packets released by one dequeue pass */
+#define dwrr_max_dequeue_batch 64
+/* Time to send an automatically sized bucket (20us) */
+#define dwrr_auto_bucket_ns 20000
 
 #define dwrr_max_iteration 10
 
 #define dwrr_round_alpha_shift 10
+/* Fixed point of shares of the link and of decay factors (1/2^20) */
+#define dwrr_share_shift 20
 
 /* The number of global (rather than 'per-queue') parameters */
-#define dwrr_global_params 10
-/* The total number of parameters (per-queue and global parameters) */
-#define dwrr_total_params (dwrr_global_params + 4 * dwrr_max_queues)
+#define dwrr_global_params 20
+/*
+ * The total number of parameters (global, per-queue and per-tenant
+ * parameters)
+ */
+#define dwrr_total_params (dwrr_global_params + 9 * dwrr_sysctl_queues)
 
 #define dwrr_disable 0
 #define dwrr_enable 1
 
+/* Round robin scheduling: DWRR, or WRR if enabled */
+#define dwrr_mode_rr 0
+/* Self-Clocked Fair Queueing (SCFQ) with virtual finish times */
+#define dwrr_mode_scfq 1
+
 /* Global parameters */
-/* Enable debug mode or not */
-extern int dwrr_enable_debug;
-/* Buffer management mode: shared (0) or static (1)*/
+/* Buffer management mode: shared (0), static (1) or dynamic threshold (2) */
 extern int dwrr_buffer_mode;
-/* Per port shared buffer (bytes) */
+/* Per port shared buffer, or shared pool of DT (bytes) */
 extern int dwrr_shared_buffer_bytes;
-/* Bucket size in bytes*/
+/* Bucket size in bytes, or 0 to derive it from the shaping rate */
 extern int dwrr_bucket_bytes;
 /* Per port ECN marking threshold (bytes) */
 extern int dwrr_port_thresh_bytes;
@@ -64,26 +119,173 @@ extern int dwrr_idle_interval_ns;
 extern int dwrr_enable_wrr;
 /* Enable dequeue ECN marking or not */
 extern int dwrr_enable_dequeue_ecn;
+/* Per port sojourn time target of delay-based MQ-ECN (ns) */
+extern int dwrr_target_delay_ns;
+/* The number of queues of new instances */
+extern int dwrr_num_queues;
+/* Scheduling mode of the DWRR band: round robin (0) or SCFQ (1) */
+extern int dwrr_sched_mode;
+/* Maximum number of packets released by one dequeue pass */
+extern int dwrr_dequeue_batch;
+/* Minimum delay of the rate limiter watchdog (ns) */
+extern int dwrr_watchdog_slack_ns;
+/* Segment GSO packets larger than the deficit of their queue or not */
+extern int dwrr_gso_split;
+/* The number of queues of each tenant of new instances, or 0 for none */
+extern int dwrr_tenant_queues;
+/* ECN marking profile: step (0), ramp (1) or ramp plus step (2) */
+extern int dwrr_ecn_profile;
+/* Start of the marking ramp (percent of the threshold) */
+extern int dwrr_ecn_ramp_min;
+/* End of the marking ramp (percent of the threshold) */
+extern int dwrr_ecn_ramp_max;
+/* Marking probability at the end of the ramp of ramp plus step (percent) */
+extern int dwrr_ecn_ramp_prob;
 
-/* Per-queue parameters */
+/*
+ * Per-queue parameters of the first dwrr_sysctl_queues queues. Other
+ * queues start with the default values and are configured through netlink.
+ */
 /* Per queue ECN marking threshold (bytes) */
-extern int dwrr_queue_thresh_bytes[dwrr_max_queues];
+extern int dwrr_queue_thresh_bytes[dwrr_sysctl_queues];
 /* DSCP value for different queues */
-extern int dwrr_queue_dscp[dwrr_max_queues];
+extern int dwrr_queue_dscp[dwrr_sysctl_queues];
 /* Quantum for different queues*/
-extern int dwrr_queue_quantum[dwrr_max_queues];
+extern int dwrr_queue_quantum[dwrr_sysctl_queues];
 /* Per queue static reserved buffer (bytes) */
-extern int dwrr_queue_buffer_bytes[dwrr_max_queues];
+extern int dwrr_queue_buffer_bytes[dwrr_sysctl_queues];
+/* Strict priority level of different queues (0 for DWRR) */
+extern int dwrr_queue_prio[dwrr_sysctl_queues];
+/* Per queue guaranteed buffer of DT (bytes) */
+extern int dwrr_queue_guarantee_bytes[dwrr_sysctl_queues];
+/* Per queue DT alpha (1/1024) */
+extern int dwrr_queue_alpha[dwrr_sysctl_queues];
+/* Per-flow fair queueing inside different queues or not */
+extern int dwrr_queue_fq[dwrr_sysctl_queues];
+/*
+ * Quantum of the first dwrr_sysctl_queues tenants, or 0 for the sum of
+ * the quanta of their queues
+ */
+extern int dwrr_tenant_quantum[dwrr_sysctl_queues];
+
+/* Queue index of every DSCP value, built from dwrr_queue_dscp */
+extern u16 dwrr_dscp_queue[dwrr_dscp_num];
+
+/**
+ *	struct dwrr_config - configuration of a scheduler instance
+ *
+ *	Every instance starts with the values of the global parameters
+ *	above, which can then be changed for this instance through netlink.
+ *	Fields have the same meaning as the global parameters, except for
+ *	@dscp_queue which is the queue index of every DSCP value.
+ *	@num_queues and @tenant_queues are fixed when the instance is created.
+ *	The 20 scalar parameters come first and fill two cache lines, which
+ *	the data path reads for every packet.
+ */
+struct dwrr_config
+{
+	int	buffer_mode;
+	int	shared_buffer_bytes;
+	int	bucket_bytes;
+	int	port_thresh_bytes;
+	int	ecn_scheme;
+	int	round_alpha;
+	int	idle_interval_ns;
+	int	enable_wrr;
+	int	enable_dequeue_ecn;
+	int	target_delay_ns;
+	int	num_queues;
+	int	sched_mode;
+	int	dequeue_batch;
+	int	watchdog_slack_ns;
+	int	gso_split;
+	int	tenant_queues;
+	int	ecn_profile;
+	int	ecn_ramp_min;
+	int	ecn_ramp_max;
+	int	ecn_ramp_prob;
 
+	u16	dscp_queue[dwrr_dscp_num];
+};
+
+/**
+ *	struct dwrr_queue_cfg - configuration of a queue of an instance
+ *	@thresh_bytes: per queue ECN marking threshold (bytes)
+ *	@quantum: quantum (bytes)
+ *	@buffer_bytes: per queue static reserved buffer (bytes)
+ *	@prio: strict priority level (a higher level goes first), or 0 for a
+ *	queue of the DWRR band
+ *	@guarantee_bytes: guaranteed buffer of dynamic threshold (bytes)
+ *	@alpha: dynamic threshold alpha (1/1024) over the free shared pool
+ *	@fq: hash flows into sub-queues served round robin, or use a FIFO
+ */
+struct dwrr_queue_cfg
+{
+	int	thresh_bytes;
+	int	quantum;
+	int	buffer_bytes;
+	int	prio;
+	int	guarantee_bytes;
+	int	alpha;
+	int	fq;
+};
+
+/**
+ *	struct dwrr_tenant_cfg - configuration of a tenant of an instance
+ *	@quantum: quantum (bytes), or 0 for the sum of the quanta of its queues
+ */
+struct dwrr_tenant_cfg
+{
+	int	quantum;
+};
+
+#define dwrr_config_offset(field) offsetof(struct dwrr_config, field)
+#define dwrr_queue_cfg_offset(field) offsetof(struct dwrr_queue_cfg, field)
+#define dwrr_tenant_cfg_offset(field) offsetof(struct dwrr_tenant_cfg, field)
+
+/*
+ * @offset: offset of the corresponding field in struct dwrr_config (or in
+ * struct dwrr_queue_cfg if @queue >= 0), or -1 if this is not a
+ * per-instance parameter
+ * @queue: queue index of a per-queue parameter, or -1. Per-queue DSCP
+ * values are -1 since they are applied to the DSCP table of the instance.
+ * @tenant: @queue is the index of a tenant, and @offset is in struct
+ * dwrr_tenant_cfg
+ * @min: minimum value, or NULL if not bounded
+ * @max: maximum value, or NULL if not bounded
+ */
 struct dwrr_param
 {
 	char name[64];
 	int *ptr;
+	int offset;
+	int queue;
+	bool tenant;
+	int *min;
+	int *max;
 };
 
 extern struct dwrr_param dwrr_params[dwrr_total_params + 1];
 
-/* Intialize parameters and register sysctl */
+/* Rebuild dwrr_dscp_queue after dwrr_queue_dscp has changed */
+void dwrr_dscp_table_update(void);
+/* Initialize the configuration of a new instance from global parameters */
+void dwrr_config_init(struct dwrr_config *cfg);
+/*
+ * Copy the global DSCP table to the instance. DSCP values of queues which
+ * the instance does not have go to queue 0.
+ */
+void dwrr_config_dscp_init(struct dwrr_config *cfg);
+/* Initialize the configuration of queue i from global parameters */
+void dwrr_queue_cfg_init(struct dwrr_queue_cfg *cfg, int i);
+/* Initialize the configuration of tenant i from global parameters */
+void dwrr_tenant_cfg_init(struct dwrr_tenant_cfg *cfg, int i);
+/*
+ * A global parameter has been written through sysctl. Implemented by the
+ * kernel module, which applies it to all the instances.
+ */
+void dwrr_params_changed(struct dwrr_param *param);
+/* Intialize parameters and register sysctl (kernel only) */
 bool dwrr_params_init(void);
 /* Unregister sysctl */
 void dwrr_params_exit(void);
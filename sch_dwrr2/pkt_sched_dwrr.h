@@ -0,0 +1,124 @@
+#ifndef __PKT_SCHED_DWRR_H__
+#define __PKT_SCHED_DWRR_H__
+
+#include <linux/types.h>
+
+/*
+ * Netlink interface of the dwrr qdisc, shared by the kernel module and the
+ * tc plugin (tc/q_dwrr.c). Scalar attributes have the same meaning and the
+ * same range as the sysctl parameters of the same name (see params.h).
+ */
+
+/* The maximum number of queues (classes) of an instance */
+#define TC_DWRR_MAX_QUEUES 1024
+/* The number of DSCP values */
+#define TC_DWRR_DSCP_NUM 64
+/*
+ * The number of buckets of a sojourn time histogram. Buckets 0-3 count
+ * 0-3 ns. Bucket 4 * (k - 1) + m (m < 4) counts
+ * [2^k + m * 2^(k-2), 2^k + (m + 1) * 2^(k-2)) ns.
+ * The last bucket also counts anything longer.
+ */
+#define TC_DWRR_HIST_BUCKETS 128
+
+/* Entries of per-queue arrays and of the DSCP map which keep their value */
+#define TC_DWRR_KEEP_U32 (~0U)
+#define TC_DWRR_KEEP_U16 0xffff
+
+enum
+{
+	TCA_DWRR_UNSPEC,
+	TCA_DWRR_RATE,			/* u32, shaping rate in bytes/s */
+	TCA_DWRR_BUCKET,		/* u32, bytes, 0 for 20us of the rate */
+	TCA_DWRR_BUFFER_MODE,		/* u32 */
+	TCA_DWRR_SHARED_BUFFER,		/* u32, bytes */
+	TCA_DWRR_PORT_THRESH,		/* u32, bytes */
+	TCA_DWRR_ECN_SCHEME,		/* u32 */
+	TCA_DWRR_ROUND_ALPHA,		/* u32 */
+	TCA_DWRR_IDLE_INTERVAL,		/* u32, ns */
+	TCA_DWRR_ENABLE_WRR,		/* u32 */
+	TCA_DWRR_ENABLE_DEQUEUE_ECN,	/* u32 */
+	TCA_DWRR_QUEUE_THRESH,		/* u32[n], bytes */
+	TCA_DWRR_QUEUE_QUANTUM,		/* u32[n], bytes */
+	TCA_DWRR_QUEUE_BUFFER,		/* u32[n], bytes */
+	TCA_DWRR_DSCP_MAP,		/* u16[TC_DWRR_DSCP_NUM], queue index */
+	TCA_DWRR_RESET_HIST,		/* flag, clear sojourn histograms */
+	TCA_DWRR_TARGET_DELAY,		/* u32, ns */
+	TCA_DWRR_QUEUES,		/* u32, number of queues, on creation */
+	TCA_DWRR_QUEUE_PRIO,		/* u32[n], strict priority, 0 for DWRR */
+	TCA_DWRR_SCHED_MODE,		/* u32 */
+	TCA_DWRR_DEQUEUE_BATCH,		/* u32, packets */
+	TCA_DWRR_WATCHDOG_SLACK,	/* u32, ns */
+	TCA_DWRR_RATE64,		/* u64, shaping rate in bytes/s */
+	TCA_DWRR_GSO_SPLIT,		/* u32 */
+	TCA_DWRR_QUEUE_GUARANTEE,	/* u32[n], bytes, DT guaranteed buffer */
+	TCA_DWRR_QUEUE_ALPHA,		/* u32[n], DT alpha in 1/1024 */
+	TCA_DWRR_QUEUE_FQ,		/* u32[n], per-flow fair queueing */
+	TCA_DWRR_TENANT_QUEUES,		/* u32, queues per tenant, on creation */
+	TCA_DWRR_TENANT_QUANTUM,	/* u32[n tenants], bytes, 0 for auto */
+	TCA_DWRR_ECN_PROFILE,		/* u32 */
+	TCA_DWRR_ECN_RAMP_MIN,		/* u32, percent of the threshold */
+	TCA_DWRR_ECN_RAMP_MAX,		/* u32, percent of the threshold */
+	TCA_DWRR_ECN_RAMP_PROB,		/* u32, percent */
+	__TCA_DWRR_MAX,
+};
+
+#define TCA_DWRR_MAX (__TCA_DWRR_MAX - 1)
+
+/*
+ * Per-queue attributes of the qdisc hold the values of queues 0 to n - 1
+ * (n <= the number of queues). In the options of class major:(i + 1), they
+ * are a single u32, the value of queue i.
+ * Per-tenant attributes hold the values of tenants 0 to n - 1. Tenant i
+ * has queues i * tenant_queues to (i + 1) * tenant_queues - 1.
+ */
+
+/* Statistics of a queue. Bytes are wire bytes. */
+struct tc_dwrr_class_xstats
+{
+	__u64	enq_bytes;
+	__u64	enq_packets;
+	__u64	deq_bytes;
+	__u64	deq_packets;
+	__u64	drops;		/* buffer overfill */
+	__u64	marks;		/* CE marks */
+	__u32	len_bytes;	/* current queue length */
+	__u32	deficit;
+	__u32	quantum;
+	__u32	pad;
+	__u64	sojourn[TC_DWRR_HIST_BUCKETS];	/* sojourn time histogram */
+	__u64	overlimits;	/* dequeues delayed by the rate limiter */
+	__u64	watchdogs;	/* rate limiter timers armed */
+};
+
+/* Statistics of the instance */
+struct tc_dwrr_qdisc_xstats
+{
+	__s64	round_time;	/* port round time estimation in ns */
+	__s64	tokens;		/* tokens in ns at the last dequeue */
+	__u32	overlimits;	/* dequeues delayed by the rate limiter */
+	__u32	backlog;	/* port buffer occupancy in bytes */
+	__u64	strict_rate;	/* rate of strict priority queues in bits/s */
+	__u32	shared_backlog;	/* occupancy of the DT shared pool in bytes */
+	__u32	pad;
+};
+
+enum
+{
+	TCA_DWRR_XSTATS_QDISC,
+	TCA_DWRR_XSTATS_CLASS,
+};
+
+/* Extended statistics (TCA_STATS_APP) of the qdisc or of a class */
+struct tc_dwrr_xstats
+{
+	__u32	type;		/* TCA_DWRR_XSTATS_* */
+	__u32	pad;
+	union
+	{
+		struct tc_dwrr_qdisc_xstats	qdisc_stats;
+		struct tc_dwrr_class_xstats	class_stats;
+	};
+};
+
+#endif
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Generate a synthetic packet trace for dwrr_sim.
+
+Each DSCP gets Poisson packet arrivals at the given offered load, as one
+long-lived flow, and optionally short flows (mice) of a few packets sent
+back to back. Output lines are
+"<timestamp in ns> <packet size in bytes> <DSCP> <flow ID>".
+"""
+import argparse
+import heapq
+import random
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('-d', '--dscp', type=int, nargs='+', default=[0, 1],
+                        help='DSCP values of the flows')
+    parser.add_argument('-l', '--load', type=float, nargs='+', default=[600],
+                        help='offered load in Mbps per DSCP (the last value '
+                             'is reused for the remaining DSCPs)')
+    parser.add_argument('-s', '--size', type=int, default=1514,
+                        help='packet size in bytes (skb->len)')
+    parser.add_argument('-t', '--duration', type=float, default=0.1,
+                        help='trace duration in seconds')
+    parser.add_argument('-m', '--mice', type=float, default=0,
+                        help='short flows per second per DSCP')
+    parser.add_argument('--mice-pkts', type=int, default=10,
+                        help='packets of a short flow')
+    parser.add_argument('--mice-gap', type=int, default=1200,
+                        help='ns between packets of a short flow')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    end = int(args.duration * 1e9)
+    events = []
+    for i, dscp in enumerate(args.dscp):
+        load = args.load[min(i, len(args.load) - 1)]
+        # mean inter-arrival time in ns
+        mean = args.size * 8 * 1e3 / load
+        heapq.heappush(events, (random.expovariate(1 / mean), dscp, i))
+
+    # Long-lived flows have IDs 0 .. len(dscp) - 1
+    flow = len(args.dscp)
+    mice = []
+    for dscp in args.dscp if args.mice > 0 else []:
+        time = random.expovariate(args.mice) * 1e9
+        while time < end:
+            for k in range(args.mice_pkts):
+                mice.append((time + k * args.mice_gap, dscp, flow))
+            flow += 1
+            time += random.expovariate(args.mice) * 1e9
+    heapq.heapify(mice)
+
+    out = sys.stdout
+    while events or mice:
+        if mice and (not events or mice[0] < events[0]):
+            time, dscp, flow = heapq.heappop(mice)
+            out.write('%d %d %d %d\n' % (time, args.size, dscp, flow))
+            continue
+
+        time, dscp, i = heapq.heappop(events)
+        if time >= end:
+            continue
+        out.write('%d %d %d %d\n' % (time, args.size, dscp, i))
+        load = args.load[min(i, len(args.load) - 1)]
+        mean = args.size * 8 * 1e3 / load
+        heapq.heappush(events, (time + random.expovariate(1 / mean),
+                                dscp, i))
+
+
+if __name__ == '__main__':
+    main()
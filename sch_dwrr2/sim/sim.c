@@ -0,0 +1,666 @@
+/*
+ * Trace-driven simulator for the DWRR/MQ-ECN core.
+ *
+ * It replays a packet trace through the same scheduling, buffer management
+ * and ECN marking code as the kernel module (../dwrr.c) at a virtual shaping
+ * rate, and reports per-queue throughput, mark rate, sojourn time
+ * percentiles, queue-depth time series and flow completion times. Each
+ * line of the trace is
+ *
+ *	<timestamp in ns> <packet size in bytes> <DSCP> [<flow ID>]
+ *
+ * where the packet size is skb->len on the egress device (Ethernet frame
+ * without FCS). Larger packets than an MTU-sized frame are TSO packets of
+ * TCP/IPv4 segments with sim_mss bytes of payload each. The flow ID (0 by
+ * default) stands for the flow hash of fair queueing. Lines starting with
+ * '#' are ignored.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dwrr.h"
+
+/* Ethernet (14B) + IPv4 (20B) + TCP (20B) headers of a TSO segment */
+#define sim_tso_hdr_bytes 54
+#define sim_mss 1460
+/* Largest frame without FCS (1514B) and largest TSO packet */
+#define sim_max_frame_bytes (dwrr_max_pkt_bytes - 24)
+#define sim_max_tso_bytes (14 + 65535)
+/* Flow IDs of the trace are smaller */
+#define sim_max_flows (1 << 20)
+
+struct sim_pkt
+{
+	s64	time;
+	u32	size;
+	u32	flow;
+	u8	dscp;
+};
+
+/*
+ * Wire length, enqueue time, and for a TSO packet, the number of segments
+ * and the total length of their frames
+ */
+struct sim_entry
+{
+	u32	len;
+	s64	time;
+	u32	segs;
+	u32	frames;
+	u32	flow;
+};
+
+/*
+ * Packets of a flow of the trace, wire bytes transmitted, arrival of the
+ * first packet and end of transmission of the last one
+ */
+struct sim_flow
+{
+	int	queue;
+	u32	pkts;
+	u32	drops;
+	u64	bytes;
+	s64	start;
+	s64	end;
+};
+
+/* Ring buffer of packets, one per flow sub-queue of each queue */
+struct sim_fifo
+{
+	struct sim_entry	*ent;
+	u32	head;
+	u32	tail;
+	u32	mask;
+};
+
+static struct dwrr_port port;
+static struct dwrr_sched_data sched;
+static struct dwrr_class *queues;
+static struct sim_fifo *fifos;
+static struct sim_flow *flow_stats;
+static u32 num_flows;
+static struct dwrr_class **heap;
+static struct dwrr_tenant *tenants;
+static struct dwrr_class_stats *stats;
+/* Rate limiter watchdog wakeups */
+static u64 wakeups;
+
+static inline struct sim_fifo *sim_flow_fifo(struct dwrr_class *cl, int i)
+{
+	return &fifos[cl->id * dwrr_fq_flows + i];
+}
+
+unsigned int dwrr_class_head_len(struct dwrr_class *cl)
+{
+	int i = dwrr_flow_next(cl);
+	struct sim_fifo *f;
+
+	if (i < 0)
+		return 0;
+
+	f = sim_flow_fifo(cl, i);
+	if (f->head == f->tail)
+		return 0;
+
+	return f->ent[f->head & f->mask].len;
+}
+
+/* Make room for n more packets */
+static void sim_fifo_reserve(struct sim_fifo *f, u32 n)
+{
+	u32 i, size = f->mask + 1;
+
+	while (f->tail - f->head + n > size)
+	{
+		struct sim_entry *buf = malloc(2 * size * sizeof(*buf));
+
+		if (!buf)
+		{
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		for (i = 0; f->head + i != f->tail; i++)
+			buf[i] = f->ent[(f->head + i) & f->mask];
+
+		free(f->ent);
+		f->ent = buf;
+		f->head = 0;
+		f->tail = i;
+		size *= 2;
+		f->mask = size - 1;
+	}
+}
+
+static void sim_fifo_push(struct sim_fifo *f, struct sim_entry *e)
+{
+	sim_fifo_reserve(f, 1);
+	f->ent[f->tail++ & f->mask] = *e;
+}
+
+/* Segment a TSO packet of a queue like skb_gso_segment() */
+unsigned int dwrr_class_head_split(struct dwrr_sched_data *q,
+				   struct dwrr_class *cl)
+{
+	int flow = dwrr_flow_next(cl);
+	struct sim_fifo *f;
+	struct sim_entry e, *seg;
+	u32 i, frame, len = 0;
+
+	if (flow < 0)
+		return 0;
+
+	f = sim_flow_fifo(cl, flow);
+	if (f->head == f->tail || f->ent[f->head & f->mask].segs <= 1)
+		return 0;
+
+	e = f->ent[f->head & f->mask];
+	sim_fifo_reserve(f, e.segs - 1);
+	f->head -= e.segs - 1;
+
+	for (i = 0; i < e.segs; i++)
+	{
+		frame = min_t(u32, e.frames, sim_tso_hdr_bytes + sim_mss);
+		e.frames -= frame;
+		seg = &f->ent[(f->head + i) & f->mask];
+		seg->len = dwrr_wire_bytes(frame);
+		seg->time = e.time;
+		seg->segs = 1;
+		seg->frames = frame;
+		seg->flow = e.flow;
+		len += seg->len;
+	}
+
+	dwrr_class_resize(q, cl, (int)len - (int)e.len);
+	return f->ent[f->head & f->mask].len;
+}
+
+/* Remove the head packet, which stays valid until the next push */
+static struct sim_entry *sim_fifo_pop(struct sim_fifo *f)
+{
+	return &f->ent[f->head++ & f->mask];
+}
+
+/* Upper bound in ns of the sojourn time of the given share of packets */
+static u64 sim_percentile(const u64 *hist, unsigned int permille)
+{
+	u64 total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < dwrr_hist_buckets; i++)
+		total += hist[i];
+
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < dwrr_hist_buckets; i++)
+	{
+		sum += hist[i];
+		if (sum * 1000 >= total * permille)
+			break;
+	}
+
+	return dwrr_hist_bucket_ns(i + 1);
+}
+
+/* Set a parameter within its bounds, as sysctl does */
+static bool sim_set_param(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	int i, val;
+
+	if (!eq)
+		return false;
+
+	for (i = 0; dwrr_params[i].ptr; i++)
+	{
+		if (strlen(dwrr_params[i].name) == (size_t)(eq - arg) &&
+		    !strncmp(dwrr_params[i].name, arg, eq - arg))
+		{
+			val = atoi(eq + 1);
+			if ((dwrr_params[i].min && val < *(dwrr_params[i].min)) ||
+			    (dwrr_params[i].max && val > *(dwrr_params[i].max)))
+				return false;
+			*(dwrr_params[i].ptr) = val;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static struct sim_pkt *sim_load_trace(FILE *fp, size_t *num)
+{
+	struct sim_pkt *trace = NULL;
+	size_t n = 0, size = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	long long time;
+	unsigned int pkt_size, dscp, flow;
+	int fields;
+
+	while (getline(&line, &line_size, fp) > 0)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		flow = 0;
+		fields = sscanf(line, "%lld %u %u %u", &time, &pkt_size, &dscp,
+				&flow);
+		if (fields < 3 ||
+		    dscp >= (1 << 6) ||
+		    flow >= sim_max_flows ||
+		    pkt_size > sim_max_tso_bytes ||
+		    (pkt_size > sim_max_frame_bytes &&
+		     pkt_size <= sim_tso_hdr_bytes + sim_mss) ||
+		    (n > 0 && time < trace[n - 1].time))
+		{
+			fprintf(stderr, "invalid trace line %zu: %s", n + 1, line);
+			exit(1);
+		}
+
+		if (n == size)
+		{
+			size = size ? 2 * size : 1 << 16;
+			trace = realloc(trace, size * sizeof(struct sim_pkt));
+			if (!trace)
+			{
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+
+		trace[n].time = time;
+		trace[n].size = pkt_size;
+		trace[n].dscp = dscp;
+		trace[n].flow = flow;
+		num_flows = max_t(u32, num_flows, flow + 1);
+		n++;
+	}
+
+	free(line);
+	*num = n;
+	return trace;
+}
+
+static void sim_sample(FILE *fp, s64 time)
+{
+	int i;
+
+	fprintf(fp, "%lld", (long long)time);
+	for (i = 0; i < sched.cfg.num_queues; i++)
+		fprintf(fp, ",%u", queues[i].len_bytes);
+	fprintf(fp, ",%d\n", atomic_read(&port.sum_len_bytes));
+}
+
+static void sim_enqueue(struct sim_pkt *pkt, s64 now)
+{
+	struct dwrr_class *cl;
+	struct sim_entry e = { .time = now, .segs = 1, .frames = pkt->size,
+			       .flow = pkt->flow };
+	struct sim_flow *fs = &flow_stats[pkt->flow];
+	int flow;
+
+	/* TSO packet: every segment has the headers */
+	if (pkt->size > sim_max_frame_bytes)
+	{
+		e.segs = DIV_ROUND_UP(pkt->size - sim_tso_hdr_bytes, sim_mss);
+		e.frames += (e.segs - 1) * sim_tso_hdr_bytes;
+	}
+	e.len = dwrr_gso_wire_bytes(e.frames, e.segs);
+
+	dwrr_idle_update(&sched, now);
+
+	cl = &queues[dwrr_classify_dscp(&sched, pkt->dscp)];
+	if (fs->pkts++ == 0)
+	{
+		fs->queue = cl->id;
+		fs->start = now;
+	}
+
+	if (dwrr_buffer_overfill(e.len, cl, &sched))
+	{
+		dwrr_stats_add(cl, drops, 1);
+		fs->drops++;
+		return;
+	}
+
+	/* Fibonacci hashing of the flow ID, like hash_32() */
+	flow = dwrr_flow_classify(cl, pkt->flow * 0x9e3779b9U);
+	sim_fifo_push(sim_flow_fifo(cl, flow), &e);
+	dwrr_enqueue_update(&sched, cl, flow, e.len, now);
+
+	if (!dwrr_dequeue_marking(&sched) &&
+	    dwrr_ecn_marking(&sched, cl, -1))
+		dwrr_ecn_marked(&sched, cl, -1);
+}
+
+/* Return the time of the next dequeue attempt */
+static s64 sim_dequeue(s64 now)
+{
+	struct dwrr_class *cl;
+	struct sim_entry *e;
+	struct sim_flow *fs;
+	unsigned int len;
+	s64 result, sojourn, delay;
+
+	cl = dwrr_schedule(&sched, now, &len, &result);
+	if (!cl)
+	{
+		if (result >= 0)
+			return now;
+		wakeups++;
+		delay = dwrr_watchdog_delay(&sched, result);
+		dwrr_watchdog_armed(&sched, delay);
+		return now + delay;
+	}
+
+	e = sim_fifo_pop(sim_flow_fifo(cl, cl->flow_head));
+	sojourn = now - e->time;
+	fs = &flow_stats[e->flow];
+	fs->bytes += len;
+	fs->end = now + l2t_ns(&sched.rate, len);
+
+	dwrr_dequeue_update(&sched, cl, len, now, result);
+	dwrr_sojourn_update(cl, sojourn);
+
+	if (dwrr_dequeue_marking(&sched) &&
+	    dwrr_ecn_marking(&sched, cl, sojourn))
+		dwrr_ecn_marked(&sched, cl, sojourn);
+
+	return now;
+}
+
+/* The first DSCP value of the queue, or -1 */
+static int sim_queue_dscp(int queue)
+{
+	int i;
+
+	for (i = 0; i < dwrr_dscp_num; i++)
+	{
+		if (sched.cfg.dscp_queue[i] == queue)
+			return i;
+	}
+
+	return -1;
+}
+
+static void usage(const char *prog)
+{
+	int i;
+
+	fprintf(stderr,
+		"Usage: %s -r RATE_MBPS [-t TRACE] [-o DEPTH_CSV] "
+		"[-i INTERVAL_NS] [-f FLOW_CSV] [-p NAME=VALUE]...\n"
+		"  -r  virtual shaping rate in Mbps\n"
+		"  -t  packet trace (default: stdin)\n"
+		"  -o  write queue-depth time series (CSV) to this file\n"
+		"  -i  sampling interval of the time series in ns "
+		"(default: 100000)\n"
+		"  -f  write flow completion times (CSV) to this file\n"
+		"  -p  set a parameter, e.g. -p ecn_scheme=3. Parameters:\n",
+		prog);
+
+	for (i = 0; dwrr_params[i].ptr; i++)
+		fprintf(stderr, "      %s (default %d)\n",
+			dwrr_params[i].name, *(dwrr_params[i].ptr));
+}
+
+int main(int argc, char **argv)
+{
+	FILE *trace_fp = stdin, *depth_fp = NULL, *flow_fp = NULL;
+	struct sim_pkt *trace;
+	struct timespec start, end;
+	size_t i = 0, num;
+	s64 now, tx_time, next_sample, interval = 100000;
+	double duration, wall, mbps, gbps;
+	u64 deq_bytes = 0;
+	u64 rate_mbps = 0;
+	unsigned long *active;
+	struct dwrr_flow *flows;
+	bool arrival;
+	int opt, j, n;
+	u32 k;
+
+	dwrr_params_init();
+
+	while ((opt = getopt(argc, argv, "r:t:o:i:f:p:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'r':
+				rate_mbps = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				trace_fp = fopen(optarg, "r");
+				if (!trace_fp)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'o':
+				depth_fp = fopen(optarg, "w");
+				if (!depth_fp)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'i':
+				interval = strtoll(optarg, NULL, 10);
+				break;
+			case 'f':
+				flow_fp = fopen(optarg, "w");
+				if (!flow_fp)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'p':
+				if (!sim_set_param(optarg))
+				{
+					fprintf(stderr, "invalid parameter %s\n",
+						optarg);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (rate_mbps == 0 || interval <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* As sysctl and netlink do, once all the parameters are set */
+	if (dwrr_ecn_ramp_min > dwrr_ecn_ramp_max)
+	{
+		fprintf(stderr, "ecn_ramp_min above ecn_ramp_max\n");
+		return 1;
+	}
+
+	dwrr_dscp_table_update();
+
+	trace = sim_load_trace(trace_fp, &num);
+	if (num == 0)
+	{
+		fprintf(stderr, "empty trace\n");
+		return 1;
+	}
+
+	dwrr_config_init(&sched.cfg);
+	n = sched.cfg.num_queues;
+	/* Queues start on cache lines, as kmalloc() gives them in the kernel */
+	queues = aligned_alloc(__alignof__(struct dwrr_class),
+			       n * sizeof(struct dwrr_class));
+	fifos = calloc(n * dwrr_fq_flows, sizeof(struct sim_fifo));
+	flow_stats = calloc(num_flows, sizeof(struct sim_flow));
+	active = calloc(dwrr_bitmap_longs(n), sizeof(unsigned long));
+	heap = calloc(n, sizeof(struct dwrr_class *));
+	tenants = calloc(max_t(int, dwrr_num_tenants(&sched.cfg), 1),
+			 sizeof(struct dwrr_tenant));
+	stats = calloc(n, sizeof(struct dwrr_class_stats));
+	if (!queues || !fifos || !flow_stats || !active || !heap ||
+	    !tenants || !stats)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(queues, 0, n * sizeof(struct dwrr_class));
+
+	/* Rings of flow sub-queues start small and grow */
+	for (j = 0; j < n * dwrr_fq_flows; j++)
+	{
+		fifos[j].mask = (1 << 4) - 1;
+		fifos[j].ent = malloc((fifos[j].mask + 1) *
+				      sizeof(struct sim_entry));
+		if (!fifos[j].ent)
+		{
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+	}
+
+	now = tx_time = next_sample = trace[0].time;
+	dwrr_port_init(&port, now);
+	dwrr_sched_init(&sched, queues, active, heap, tenants, stats, &port,
+			now);
+	for (j = 0; j < n; j++)
+	{
+		if ((queues[j]).cfg.fq != dwrr_enable)
+			continue;
+
+		flows = calloc(dwrr_fq_flows, sizeof(struct dwrr_flow));
+		if (!flows)
+		{
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		dwrr_flows_attach(&(queues[j]), flows);
+	}
+	sched.rate.rate_bps = rate_mbps * 1000000;
+	precompute_ratedata(&sched.rate);
+	dwrr_sched_config(&sched);
+
+	if (depth_fp)
+	{
+		fprintf(depth_fp, "time_ns");
+		for (j = 0; j < n; j++)
+			fprintf(depth_fp, ",q%d", j);
+		fprintf(depth_fp, ",port\n");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (i < num || atomic_read(&port.sum_len_bytes) > 0)
+	{
+		/* Packet arrivals go first */
+		arrival = i < num &&
+			  (atomic_read(&port.sum_len_bytes) == 0 ||
+			   trace[i].time <= tx_time);
+		now = arrival ? trace[i].time : tx_time;
+
+		for (; depth_fp && next_sample <= now; next_sample += interval)
+			sim_sample(depth_fp, next_sample);
+
+		if (arrival)
+		{
+			sim_enqueue(&trace[i++], now);
+			tx_time = max_t(s64, tx_time, now);
+		}
+		else
+		{
+			tx_time = sim_dequeue(now);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	duration = (double)(now - trace[0].time) / NSEC_PER_SEC;
+	wall = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("queue,dscp,enq_pkts,deq_pkts,drop_pkts,mark_pkts,"
+	       "mark_rate,throughput_mbps,"
+	       "sojourn_p50_ns,sojourn_p99_ns,sojourn_p999_ns,"
+	       "overlimits,watchdogs\n");
+	for (j = 0; j < n; j++)
+	{
+		struct dwrr_class_stats sum, *st = &sum;
+		const u64 *sojourn = queues[j].sojourn;
+
+		dwrr_class_stats_read(&queues[j], &sum);
+		mbps = duration > 0 ? st->deq_bytes * 8 / duration / 1e6 : 0;
+		deq_bytes += st->deq_bytes;
+		printf("%d,%d,%llu,%llu,%llu,%llu,%.6f,%.3f,%llu,%llu,%llu,"
+		       "%llu,%llu\n",
+		       j,
+		       sim_queue_dscp(j),
+		       (unsigned long long)st->enq_pkts,
+		       (unsigned long long)st->deq_pkts,
+		       (unsigned long long)st->drops,
+		       (unsigned long long)st->marks,
+		       st->enq_pkts ? (double)st->marks / st->enq_pkts : 0,
+		       mbps,
+		       (unsigned long long)sim_percentile(sojourn, 500),
+		       (unsigned long long)sim_percentile(sojourn, 990),
+		       (unsigned long long)sim_percentile(sojourn, 999),
+		       (unsigned long long)st->overlimits,
+		       (unsigned long long)st->watchdogs);
+	}
+
+	fprintf(stderr, "simulated %zu packets (%.6f s) in %.3f s: %.2f Mpps, "
+		"%.1f ns per packet\n",
+		num, duration, wall, wall > 0 ? num / wall / 1e6 : 0,
+		num > 0 ? wall * 1e9 / num : 0);
+	/* Each wakeup is a timer interrupt and a softirq in the kernel */
+	gbps = duration > 0 ? deq_bytes * 8 / duration / 1e9 : 0;
+	fprintf(stderr, "%llu watchdog wakeups: %.0f per second per Gbps "
+		"shaped\n", (unsigned long long)wakeups,
+		gbps > 0 ? wakeups / duration / gbps : 0);
+
+	if (flow_fp)
+	{
+		fprintf(flow_fp, "flow,queue,pkts,drop_pkts,bytes,start_ns,"
+			"fct_ns\n");
+		for (k = 0; k < num_flows; k++)
+		{
+			struct sim_flow *fs = &flow_stats[k];
+
+			if (fs->pkts == 0)
+				continue;
+			fprintf(flow_fp, "%u,%d,%u,%u,%llu,%lld,%lld\n",
+				k, fs->queue, fs->pkts, fs->drops,
+				(unsigned long long)fs->bytes,
+				(long long)fs->start,
+				(long long)(fs->bytes ? fs->end - fs->start : 0));
+		}
+		fclose(flow_fp);
+	}
+
+	if (depth_fp)
+		fclose(depth_fp);
+	for (j = 0; j < n * dwrr_fq_flows; j++)
+		free(fifos[j].ent);
+	free(fifos);
+	for (j = 0; j < n; j++)
+	{
+		if (dwrr_class_flows(&(queues[j])) > 1)
+			free((queues[j]).flows);
+	}
+	free(flow_stats);
+	free(queues);
+	free(active);
+	free(heap);
+	free(tenants);
+	free(stats);
+	free(trace);
+	return 0;
+}
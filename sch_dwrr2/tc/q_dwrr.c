@@ -0,0 +1,482 @@
+/*
+ * q_dwrr.c	tc plugin for the dwrr (DWRR/MQ-ECN) qdisc.
+ *
+ * Build it against an iproute2 source tree and copy q_dwrr.so to the tc
+ * library directory (TC_LIB_DIR, /usr/lib/tc by default). tc loads it when
+ * it sees the "dwrr" qdisc.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tc_util.h"
+
+#include "pkt_sched_dwrr.h"
+
+static void explain(void)
+{
+	fprintf(stderr,
+		"Usage: ... dwrr rate RATE [ queues NUMBER ] [ bucket BYTES ]\n"
+		"		[ buffer_mode 0|1|2 ] [ shared_buffer BYTES ]\n"
+		"		[ ecn_scheme 0|1|2|3|4 ] [ port_thresh BYTES ]\n"
+		"		[ target_delay_ns NS ]\n"
+		"		[ round_alpha ALPHA ] [ idle_interval_ns NS ]\n"
+		"		[ enable_wrr 0|1 ] [ enable_dequeue_ecn 0|1 ]\n"
+		"		[ sched_mode 0|1 ] [ dequeue_batch PACKETS ]\n"
+		"		[ watchdog_slack_ns NS ] [ gso_split 0|1 ]\n"
+		"		[ ecn_profile 0|1|2 ] [ ecn_ramp_min PERCENT ]\n"
+		"		[ ecn_ramp_max PERCENT ] [ ecn_ramp_prob PERCENT ]\n"
+		"		[ queue_thresh BYTES0 BYTES1 ... ]\n"
+		"		[ queue_quantum BYTES0 BYTES1 ... ]\n"
+		"		[ queue_buffer BYTES0 BYTES1 ... ]\n"
+		"		[ queue_prio LEVEL0 LEVEL1 ... ]\n"
+		"		[ queue_guarantee BYTES0 BYTES1 ... ]\n"
+		"		[ queue_alpha ALPHA0 ALPHA1 ... ]\n"
+		"		[ queue_fq 0|1 0|1 ... ]\n"
+		"		[ tenant_queues NUMBER ]\n"
+		"		[ tenant_quantum BYTES0 BYTES1 ... ]\n"
+		"		[ dscp DSCP:QUEUE ... ] [ reset_hist ]\n"
+		"Parameters have the same meaning as the dwrr.* sysctls.\n"
+		"Per-queue lists start from queue 0; other queues are kept.\n"
+		"queues (default: the dwrr.num_queues sysctl) is only accepted\n"
+		"when the qdisc is created. Queue i is class MAJOR:(i + 1).\n"
+		"Queues of strict priority level 1-7 go before the DWRR\n"
+		"queues (level 0), the highest level first.\n"
+		"With buffer_mode 2, a queue holds up to queue_alpha / 1024\n"
+		"times the free shared buffer beyond its queue_guarantee.\n"
+		"With queue_fq 1, flows of a queue are hashed into sub-queues\n"
+		"served round robin inside the share of the queue.\n"
+		"tenant_queues N (only on creation) groups queues N by N into\n"
+		"tenants, which share the DWRR band by tenant_quantum (0 for\n"
+		"the sum of the quanta of their queues).\n"
+		"ecn_profile 1 marks with a probability rising from 0 to 1\n"
+		"between ecn_ramp_min and ecn_ramp_max percent of the ECN\n"
+		"threshold, ecn_profile 2 up to ecn_ramp_prob percent and\n"
+		"every packet above the ramp.\n");
+}
+
+/*
+ * Parse "VAL0 VAL1 ..." for the first queues, keeping the others. Return
+ * the number of values or -1.
+ */
+static int dwrr_parse_queue_list(int *argc_p, char ***argv_p, __u32 *vals)
+{
+	int argc = *argc_p, n = 0;
+	char **argv = *argv_p;
+
+	while (argc > 1 && n < TC_DWRR_MAX_QUEUES &&
+	       get_size(&vals[n], argv[1]) == 0)
+	{
+		argc--;
+		argv++;
+		n++;
+	}
+
+	*argc_p = argc;
+	*argv_p = argv;
+	return n > 0 ? n : -1;
+}
+
+/* Parse "DSCP:QUEUE ..." */
+static int dwrr_parse_dscp_map(int *argc_p, char ***argv_p, __u16 *map)
+{
+	int argc = *argc_p, n = 0;
+	char **argv = *argv_p;
+	unsigned int dscp, queue;
+	char c;
+
+	for (dscp = 0; dscp < TC_DWRR_DSCP_NUM; dscp++)
+		map[dscp] = TC_DWRR_KEEP_U16;
+
+	while (argc > 1 &&
+	       sscanf(argv[1], "%u:%u%c", &dscp, &queue, &c) == 2)
+	{
+		if (dscp >= TC_DWRR_DSCP_NUM || queue >= TC_DWRR_MAX_QUEUES)
+			return -1;
+		map[dscp] = queue;
+		argc--;
+		argv++;
+		n++;
+	}
+
+	*argc_p = argc;
+	*argv_p = argv;
+	return n > 0 ? 0 : -1;
+}
+
+static const struct
+{
+	const char	*name;
+	int		type;
+} dwrr_u32_opts[] = {
+	{ "queues",		TCA_DWRR_QUEUES },
+	{ "buffer_mode",	TCA_DWRR_BUFFER_MODE },
+	{ "ecn_scheme",		TCA_DWRR_ECN_SCHEME },
+	{ "round_alpha",	TCA_DWRR_ROUND_ALPHA },
+	{ "idle_interval_ns",	TCA_DWRR_IDLE_INTERVAL },
+	{ "enable_wrr",		TCA_DWRR_ENABLE_WRR },
+	{ "enable_dequeue_ecn",	TCA_DWRR_ENABLE_DEQUEUE_ECN },
+	{ "target_delay_ns",	TCA_DWRR_TARGET_DELAY },
+	{ "sched_mode",		TCA_DWRR_SCHED_MODE },
+	{ "dequeue_batch",	TCA_DWRR_DEQUEUE_BATCH },
+	{ "watchdog_slack_ns",	TCA_DWRR_WATCHDOG_SLACK },
+	{ "gso_split",		TCA_DWRR_GSO_SPLIT },
+	{ "tenant_queues",	TCA_DWRR_TENANT_QUEUES },
+	{ "ecn_profile",	TCA_DWRR_ECN_PROFILE },
+	{ "ecn_ramp_min",	TCA_DWRR_ECN_RAMP_MIN },
+	{ "ecn_ramp_max",	TCA_DWRR_ECN_RAMP_MAX },
+	{ "ecn_ramp_prob",	TCA_DWRR_ECN_RAMP_PROB },
+};
+
+static const struct
+{
+	const char	*name;
+	int		type;
+} dwrr_size_opts[] = {
+	{ "bucket",		TCA_DWRR_BUCKET },
+	{ "shared_buffer",	TCA_DWRR_SHARED_BUFFER },
+	{ "port_thresh",	TCA_DWRR_PORT_THRESH },
+};
+
+static const struct
+{
+	const char	*name;
+	int		type;
+} dwrr_queue_opts[] = {
+	{ "queue_thresh",	TCA_DWRR_QUEUE_THRESH },
+	{ "queue_quantum",	TCA_DWRR_QUEUE_QUANTUM },
+	{ "queue_buffer",	TCA_DWRR_QUEUE_BUFFER },
+	{ "queue_prio",		TCA_DWRR_QUEUE_PRIO },
+	{ "queue_guarantee",	TCA_DWRR_QUEUE_GUARANTEE },
+	{ "queue_alpha",	TCA_DWRR_QUEUE_ALPHA },
+	{ "queue_fq",		TCA_DWRR_QUEUE_FQ },
+	{ "tenant_quantum",	TCA_DWRR_TENANT_QUANTUM },
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static int dwrr_parse_opt(struct qdisc_util *qu, int argc, char **argv,
+			  struct nlmsghdr *n)
+{
+	__u32 vals[TC_DWRR_MAX_QUEUES], val;
+	__u64 rate64;
+	__u16 map[TC_DWRR_DSCP_NUM];
+	struct rtattr *tail;
+	unsigned int i;
+	int num;
+
+	tail = NLMSG_TAIL(n);
+	addattr_l(n, TCA_BUF_MAX, TCA_OPTIONS, NULL, 0);
+
+	while (argc > 0)
+	{
+		if (strcmp(*argv, "rate") == 0)
+		{
+			NEXT_ARG();
+			if (get_rate64(&rate64, *argv))
+			{
+				fprintf(stderr, "Illegal \"rate\"\n");
+				return -1;
+			}
+			/* Old kernels only know the 32-bit rate */
+			if (rate64 >= (1ULL << 32))
+				addattr_l(n, TCA_BUF_MAX, TCA_DWRR_RATE64,
+					  &rate64, sizeof(rate64));
+			else
+				addattr32(n, TCA_BUF_MAX, TCA_DWRR_RATE,
+					  rate64);
+			goto next;
+		}
+		else if (strcmp(*argv, "dscp") == 0)
+		{
+			if (dwrr_parse_dscp_map(&argc, &argv, map))
+			{
+				fprintf(stderr, "Illegal \"dscp\"\n");
+				return -1;
+			}
+			addattr_l(n, TCA_BUF_MAX, TCA_DWRR_DSCP_MAP,
+				  map, sizeof(map));
+			goto next;
+		}
+		else if (strcmp(*argv, "reset_hist") == 0)
+		{
+			addattr_l(n, TCA_BUF_MAX, TCA_DWRR_RESET_HIST, NULL, 0);
+			goto next;
+		}
+		else if (strcmp(*argv, "help") == 0)
+		{
+			explain();
+			return -1;
+		}
+
+		for (i = 0; i < ARRAY_LEN(dwrr_u32_opts); i++)
+		{
+			if (strcmp(*argv, dwrr_u32_opts[i].name))
+				continue;
+			NEXT_ARG();
+			if (get_u32(&val, *argv, 0))
+				goto illegal;
+			addattr32(n, TCA_BUF_MAX, dwrr_u32_opts[i].type, val);
+			goto next;
+		}
+
+		for (i = 0; i < ARRAY_LEN(dwrr_size_opts); i++)
+		{
+			if (strcmp(*argv, dwrr_size_opts[i].name))
+				continue;
+			NEXT_ARG();
+			if (get_size(&val, *argv))
+				goto illegal;
+			addattr32(n, TCA_BUF_MAX, dwrr_size_opts[i].type, val);
+			goto next;
+		}
+
+		for (i = 0; i < ARRAY_LEN(dwrr_queue_opts); i++)
+		{
+			if (strcmp(*argv, dwrr_queue_opts[i].name))
+				continue;
+			num = dwrr_parse_queue_list(&argc, &argv, vals);
+			if (num < 0)
+				goto illegal;
+			addattr_l(n, TCA_BUF_MAX, dwrr_queue_opts[i].type,
+				  vals, num * sizeof(__u32));
+			goto next;
+		}
+
+		fprintf(stderr, "What is \"%s\"?\n", *argv);
+		explain();
+		return -1;
+illegal:
+		fprintf(stderr, "Illegal \"%s\"\n", *argv);
+		return -1;
+next:
+		argc--;
+		argv++;
+	}
+
+	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
+	return 0;
+}
+
+static void dwrr_print_queue_list(FILE *f, const char *name,
+				  struct rtattr *rta)
+{
+	__u32 *vals;
+	int i, n;
+
+	if (!rta)
+		return;
+
+	vals = RTA_DATA(rta);
+	n = RTA_PAYLOAD(rta) / sizeof(__u32);
+	fprintf(f, "\n %s", name);
+	for (i = 0; i < n; i++)
+		fprintf(f, " %u", vals[i]);
+}
+
+static int dwrr_print_opt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
+{
+	struct rtattr *tb[TCA_DWRR_MAX + 1];
+	unsigned int i;
+	__u16 *map;
+	SPRINT_BUF(b1);
+
+	if (opt == NULL)
+		return 0;
+
+	parse_rtattr_nested(tb, TCA_DWRR_MAX, opt);
+
+	if (tb[TCA_DWRR_RATE64] &&
+	    RTA_PAYLOAD(tb[TCA_DWRR_RATE64]) >= sizeof(__u64))
+		fprintf(f, "rate %s ",
+			sprint_rate(rta_getattr_u64(tb[TCA_DWRR_RATE64]), b1));
+	else if (tb[TCA_DWRR_RATE] &&
+		 RTA_PAYLOAD(tb[TCA_DWRR_RATE]) >= sizeof(__u32))
+		fprintf(f, "rate %s ",
+			sprint_rate(rta_getattr_u32(tb[TCA_DWRR_RATE]), b1));
+
+	for (i = 0; i < ARRAY_LEN(dwrr_size_opts); i++)
+	{
+		struct rtattr *rta = tb[dwrr_size_opts[i].type];
+
+		if (rta && RTA_PAYLOAD(rta) >= sizeof(__u32))
+			fprintf(f, "%s %s ", dwrr_size_opts[i].name,
+				sprint_size(rta_getattr_u32(rta), b1));
+	}
+
+	for (i = 0; i < ARRAY_LEN(dwrr_u32_opts); i++)
+	{
+		struct rtattr *rta = tb[dwrr_u32_opts[i].type];
+
+		if (rta && RTA_PAYLOAD(rta) >= sizeof(__u32))
+			fprintf(f, "%s %u ", dwrr_u32_opts[i].name,
+				rta_getattr_u32(rta));
+	}
+
+	for (i = 0; i < ARRAY_LEN(dwrr_queue_opts); i++)
+		dwrr_print_queue_list(f, dwrr_queue_opts[i].name,
+				      tb[dwrr_queue_opts[i].type]);
+
+	/* Only print DSCP values which do not go to queue 0 */
+	if (tb[TCA_DWRR_DSCP_MAP] &&
+	    RTA_PAYLOAD(tb[TCA_DWRR_DSCP_MAP]) >=
+	    sizeof(__u16) * TC_DWRR_DSCP_NUM)
+	{
+		map = RTA_DATA(tb[TCA_DWRR_DSCP_MAP]);
+		fprintf(f, "\n dscp");
+		for (i = 0; i < TC_DWRR_DSCP_NUM; i++)
+		{
+			if (map[i] != 0)
+				fprintf(f, " %u:%u", i, map[i]);
+		}
+	}
+
+	return 0;
+}
+
+/* Options of a class: the parameters of its queue */
+static int dwrr_print_copt(struct qdisc_util *qu, FILE *f, struct rtattr *opt)
+{
+	struct rtattr *tb[TCA_DWRR_MAX + 1];
+	unsigned int i;
+
+	if (opt == NULL)
+		return 0;
+
+	parse_rtattr_nested(tb, TCA_DWRR_MAX, opt);
+
+	for (i = 0; i < ARRAY_LEN(dwrr_queue_opts); i++)
+	{
+		struct rtattr *rta = tb[dwrr_queue_opts[i].type];
+
+		/* Skip "queue_" */
+		if (rta && RTA_PAYLOAD(rta) >= sizeof(__u32))
+			fprintf(f, "%s %u ", dwrr_queue_opts[i].name + 6,
+				rta_getattr_u32(rta));
+	}
+
+	return 0;
+}
+
+/* Lower bound in ns of a histogram bucket (see TC_DWRR_HIST_BUCKETS) */
+static __u64 dwrr_hist_bucket_ns(int i)
+{
+	int k = (i >> 2) + 1;
+
+	if (i < 4)
+		return i;
+
+	return (1ULL << k) + ((__u64)(i & 3) << (k - 2));
+}
+
+/* Upper bound in ns of the sojourn time of the given share of packets */
+static __u64 dwrr_hist_percentile(const __u64 *hist, unsigned int permille)
+{
+	__u64 total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < TC_DWRR_HIST_BUCKETS; i++)
+		total += hist[i];
+
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < TC_DWRR_HIST_BUCKETS; i++)
+	{
+		sum += hist[i];
+		if (sum * 1000 >= total * permille)
+			break;
+	}
+
+	return dwrr_hist_bucket_ns(i + 1);
+}
+
+static void dwrr_print_sojourn(FILE *f, const __u64 *hist)
+{
+	int i;
+
+	fprintf(f, "\n  sojourn p50 %.1fus p99 %.1fus p999 %.1fus",
+		dwrr_hist_percentile(hist, 500) / 1000.0,
+		dwrr_hist_percentile(hist, 990) / 1000.0,
+		dwrr_hist_percentile(hist, 999) / 1000.0);
+
+	if (!show_details)
+		return;
+
+	for (i = 0; i < TC_DWRR_HIST_BUCKETS; i++)
+	{
+		if (hist[i])
+			fprintf(f, "\n   [%lluns, %lluns) %llu",
+				(unsigned long long)dwrr_hist_bucket_ns(i),
+				(unsigned long long)dwrr_hist_bucket_ns(i + 1),
+				(unsigned long long)hist[i]);
+	}
+}
+
+static int dwrr_print_xstats(struct qdisc_util *qu, FILE *f,
+			     struct rtattr *xstats)
+{
+	struct tc_dwrr_xstats st;
+	struct tc_dwrr_qdisc_xstats *qst = &st.qdisc_stats;
+	struct tc_dwrr_class_xstats *cst = &st.class_stats;
+	SPRINT_BUF(b1);
+
+	if (xstats == NULL)
+		return 0;
+
+	/* Newer kernels may append fields */
+	memset(&st, 0, sizeof(st));
+	memcpy(&st, RTA_DATA(xstats),
+	       MIN(RTA_PAYLOAD(xstats), sizeof(st)));
+
+	switch (st.type)
+	{
+		case TCA_DWRR_XSTATS_QDISC:
+		{
+			fprintf(f, " round_time %lldns tokens %lldns "
+				"overlimits %u port_backlog %ub "
+				"strict_rate %s shared_backlog %ub",
+				(long long)qst->round_time,
+				(long long)qst->tokens,
+				qst->overlimits, qst->backlog,
+				sprint_rate(qst->strict_rate >> 3, b1),
+				qst->shared_backlog);
+			break;
+		}
+		case TCA_DWRR_XSTATS_CLASS:
+		{
+			fprintf(f, " enq %llub %llup deq %llub %llup "
+				"drops %llu marks %llu backlog %ub "
+				"deficit %u quantum %u overlimits %llu "
+				"watchdogs %llu",
+				(unsigned long long)cst->enq_bytes,
+				(unsigned long long)cst->enq_packets,
+				(unsigned long long)cst->deq_bytes,
+				(unsigned long long)cst->deq_packets,
+				(unsigned long long)cst->drops,
+				(unsigned long long)cst->marks,
+				cst->len_bytes, cst->deficit, cst->quantum,
+				(unsigned long long)cst->overlimits,
+				(unsigned long long)cst->watchdogs);
+			dwrr_print_sojourn(f, cst->sojourn);
+			break;
+		}
+		default:
+		{
+			fprintf(f, " unknown xstats type %u", st.type);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+struct qdisc_util dwrr_qdisc_util = {
+	.id		= "dwrr",
+	.parse_qopt	= dwrr_parse_opt,
+	.print_qopt	= dwrr_print_opt,
+	.print_copt	= dwrr_print_copt,
+	.print_xstats	= dwrr_print_xstats,
+};
@@ -0,0 +1,206 @@
+/*
+ * Tracepoints of the DWRR/MQ-ECN scheduler. They replace the old printk
+ * debug mode and cost a static branch when disabled. To use them:
+ *
+ *	$ perf record -e 'dwrr:*' -a
+ *	$ echo 1 > /sys/kernel/debug/tracing/events/dwrr/enable
+ *
+ * @sched identifies the scheduler instance (one per TX queue under mq).
+ * Queue and port lengths are in wire bytes, times are in ns.
+ */
+#ifdef __KERNEL__
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dwrr
+
+#if !defined(_DWRR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DWRR_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "dwrr.h"
+
+DECLARE_EVENT_CLASS(dwrr_pkt,
+
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 unsigned int len),
+
+	TP_ARGS(q, cl, len),
+
+	TP_STRUCT__entry(
+		__field(const void *,	sched)
+		__field(int,		id)
+		__field(unsigned int,	len)
+		__field(u32,		len_bytes)
+		__field(int,		port_bytes)
+		__field(s64,		round_time)
+	),
+
+	TP_fast_assign(
+		__entry->sched = q;
+		__entry->id = cl->id;
+		__entry->len = len;
+		__entry->len_bytes = cl->len_bytes;
+		__entry->port_bytes = atomic_read(&q->port->sum_len_bytes);
+		__entry->round_time = atomic64_read(&q->port->round_time);
+	),
+
+	TP_printk("sched=%p queue=%d len=%u queue_bytes=%u port_bytes=%d "
+		  "round_time=%lld",
+		  __entry->sched, __entry->id, __entry->len,
+		  __entry->len_bytes, __entry->port_bytes,
+		  (long long)__entry->round_time)
+);
+
+/* After a packet has been appended to the queue */
+DEFINE_EVENT(dwrr_pkt, dwrr_enqueue,
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 unsigned int len),
+	TP_ARGS(q, cl, len)
+);
+
+/* After the head packet has left the queue */
+DEFINE_EVENT(dwrr_pkt, dwrr_dequeue,
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 unsigned int len),
+	TP_ARGS(q, cl, len)
+);
+
+/* A packet is dropped because the buffer is overfilled */
+DEFINE_EVENT(dwrr_pkt, dwrr_drop,
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 unsigned int len),
+	TP_ARGS(q, cl, len)
+);
+
+/*
+ * A packet has been marked with CE. @bytes is the queue length (per-queue
+ * ECN and MQ-ECN), the port length (per-port ECN) or the sojourn time in ns
+ * (delay-based MQ-ECN) compared to @thresh.
+ */
+TRACE_EVENT(dwrr_mark,
+
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 u64 bytes, u64 thresh),
+
+	TP_ARGS(q, cl, bytes, thresh),
+
+	TP_STRUCT__entry(
+		__field(const void *,	sched)
+		__field(int,		id)
+		__field(u64,		bytes)
+		__field(u64,		thresh)
+		__field(int,		ecn_scheme)
+		__field(u32,		quantum)
+		__field(s64,		round_time)
+	),
+
+	TP_fast_assign(
+		__entry->sched = q;
+		__entry->id = cl->id;
+		__entry->bytes = bytes;
+		__entry->thresh = thresh;
+		__entry->ecn_scheme = q->cfg.ecn_scheme;
+		__entry->quantum = cl->quantum;
+		__entry->round_time = atomic64_read(&q->port->round_time);
+	),
+
+	TP_printk("sched=%p queue=%d bytes=%llu thresh=%llu ecn_scheme=%d "
+		  "quantum=%u round_time=%lld",
+		  __entry->sched, __entry->id,
+		  (unsigned long long)__entry->bytes,
+		  (unsigned long long)__entry->thresh,
+		  __entry->ecn_scheme, __entry->quantum,
+		  (long long)__entry->round_time)
+);
+
+/*
+ * A new round time sample of the queue (id -1, sample 0 for idle decay).
+ * With tenants, samples of tenant @id go to the round time of the port
+ * (@tenant -1), and samples of queue @id go to that of its @tenant.
+ */
+TRACE_EVENT(dwrr_round,
+
+	TP_PROTO(struct dwrr_sched_data *q, int tenant, int id, s64 sample,
+		 s64 smooth),
+
+	TP_ARGS(q, tenant, id, sample, smooth),
+
+	TP_STRUCT__entry(
+		__field(const void *,	sched)
+		__field(int,		tenant)
+		__field(int,		id)
+		__field(s64,		sample)
+		__field(s64,		smooth)
+	),
+
+	TP_fast_assign(
+		__entry->sched = q;
+		__entry->tenant = tenant;
+		__entry->id = id;
+		__entry->sample = sample;
+		__entry->smooth = smooth;
+	),
+
+	TP_printk("sched=%p tenant=%d id=%d sample=%lld smooth=%lld",
+		  __entry->sched, __entry->tenant, __entry->id,
+		  (long long)__entry->sample, (long long)__entry->smooth)
+);
+
+/* A timer is armed, @delay ns ahead, for the head packet of the queue */
+TRACE_EVENT(dwrr_watchdog,
+
+	TP_PROTO(struct dwrr_sched_data *q, struct dwrr_class *cl,
+		 unsigned int len, s64 delay),
+
+	TP_ARGS(q, cl, len, delay),
+
+	TP_STRUCT__entry(
+		__field(const void *,	sched)
+		__field(int,		id)
+		__field(unsigned int,	len)
+		__field(u32,		len_bytes)
+		__field(s64,		delay)
+		__field(s64,		tokens)
+	),
+
+	TP_fast_assign(
+		__entry->sched = q;
+		__entry->id = cl->id;
+		__entry->len = len;
+		__entry->len_bytes = cl->len_bytes;
+		__entry->delay = delay;
+		__entry->tokens = q->tokens;
+	),
+
+	TP_printk("sched=%p queue=%d len=%u queue_bytes=%u delay=%lld "
+		  "tokens=%lld",
+		  __entry->sched, __entry->id, __entry->len,
+		  __entry->len_bytes, (long long)__entry->delay,
+		  (long long)__entry->tokens)
+);
+
+#endif /* _DWRR_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
+
+#else
+
+/* No tracepoints in userspace */
+#ifndef _DWRR_TRACE_H
+#define _DWRR_TRACE_H
+
+#define trace_dwrr_enqueue(q, cl, len)			do { } while (0)
+#define trace_dwrr_dequeue(q, cl, len)			do { } while (0)
+#define trace_dwrr_drop(q, cl, len)			do { } while (0)
+#define trace_dwrr_mark(q, cl, bytes, thresh)		do { } while (0)
+#define trace_dwrr_round(q, tenant, id, sample, smooth)	do { } while (0)
+#define trace_dwrr_watchdog(q, cl, len, delay)		do { } while (0)
+#define trace_dwrr_mark_enabled()			false
+
+#endif
+
+#endif